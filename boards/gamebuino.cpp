@@ -1,25 +1,39 @@
 #include "gamebuino.h"
+#include "buildcache.h"
+#include "project.h"
+#include "parallel.h"
 #include "helpers.h"
+#include "palette.h"
+#include "pixels.h"
 #include <fmt/format.h>
+#include <sstream>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-struct Resource
+std::vector<Resource> resources;
+
+void encode_file(std::ostream & stream, Resource res, const PaletteMapper & palette, Dither dither);
+
+static bool isIndexed(Format format)
 {
-    std::string filename;
-    Format format;
-    int xcount = 1;
-    int ycount = 1;
-    int loop = 0;
-};
+    return format == Format::Indexed || format == Format::IndexedRle;
+}
 
-std::vector<Resource> resources;
+static bool isPacked(Format format)
+{
+    return format == Format::Rgb565Lz || format == Format::IndexedRle;
+}
 
-void encode_file(std::ofstream & stream, Resource res);
+static std::string_view resourceType(Format format)
+{
+    return isIndexed(format) ? "uint8_t" : "uint16_t";
+}
 
-void build_gamebuino(std::string project_name, std::vector<ClassFile> files)
+void build_gamebuino(Project & project)
 {
+    auto & project_name = project.name;
+
     if (!helpers::can_execute("arduino-cli"))
     {
         fmt::print("Could not find 'arduino-cli'.");
@@ -33,15 +47,13 @@ void build_gamebuino(std::string project_name, std::vector<ClassFile> files)
     fs::create_directories(project_name + "/build");
     fs::current_path(tempPath / project_name);
 
-    for (auto & file : files)
-    {
-        file.generate(files, Board::Gamebuino);
-    }
+    project.generate(Board::Gamebuino);
 
-    std::ofstream output_header("gamebuino-java.h");
+    std::ostringstream output_header;
 
     output_header << R"___(
 #include <Gamebuino-Meta.h>
+#include <new>
 
 namespace std
 {
@@ -83,7 +95,157 @@ namespace gamebuino {
         inline auto MENU = BUTTON_MENU;
     }
 
-    using Image = ::Gamebuino_Meta::Image;
+    // images of the Rgb565Lz and IndexedRle formats, the header is followed by
+    // every frame packed and prefixed with its packed size (2 elements, LE)
+    namespace packing {
+        inline size_t headerSize(const uint16_t *) { return 6; }
+        inline size_t headerSize(const uint8_t *) { return 7; }
+        inline uint16_t frames(const uint16_t * buffer) { return buffer[2]; }
+        inline uint16_t frames(const uint8_t * buffer) { return buffer[2] | (buffer[3] << 8); }
+        inline bool packed(const uint16_t * buffer) { return buffer[5] & 0x80; }
+        inline bool packed(const uint8_t * buffer) { return buffer[6] & 0x80; }
+        inline size_t frameSize(const uint16_t * buffer) { return buffer[0] * buffer[1]; }
+        inline size_t frameSize(const uint8_t * buffer) { return ((buffer[0] + 1) / 2) * buffer[1]; }
+
+        // header of an image of a single unpacked frame
+        inline void singleFrame(uint16_t * buffer) { buffer[2] = 1; buffer[3] = 0; buffer[5] &= 0x7F; }
+        inline void singleFrame(uint8_t * buffer) { buffer[2] = 1; buffer[3] = 0; buffer[4] = 0; buffer[6] &= 0x7F; }
+
+        // LZ: token (literals << 8 | match length), the literals, then the
+        // backward offset of the match if there is one
+        inline void unpack(const uint16_t * in, const uint16_t * end, uint16_t * out)
+        {
+            while (in < end)
+            {
+                uint16_t token = *in++;
+                for (int i = token >> 8; i > 0; --i) *out++ = *in++;
+                int length = token & 0xFF;
+                if (length)
+                {
+                    const uint16_t * from = out - *in++;
+                    while (length--) *out++ = *from++;
+                }
+            }
+        }
+
+        // PackBits: n < 128 copies the next n + 1 bytes, otherwise the next
+        // byte is repeated n - 126 times
+        inline void unpack(const uint8_t * in, const uint8_t * end, uint8_t * out)
+        {
+            while (in < end)
+            {
+                uint8_t n = *in++;
+                if (n < 128)
+                {
+                    for (int i = 0; i <= n; ++i) *out++ = *in++;
+                }
+                else
+                {
+                    uint8_t value = *in++;
+                    for (int i = n - 126; i > 0; --i) *out++ = value;
+                }
+            }
+        }
+
+        template <typename T>
+        inline void unpackFrame(const T * buffer, uint16_t frame, T * out)
+        {
+            const T * in = buffer + headerSize(buffer);
+            for (;;)
+            {
+                uint32_t size = in[0] | (uint32_t(in[1]) << (8 * sizeof(T)));
+                in += 2;
+                if (frame-- == 0)
+                {
+                    unpack(in, in + size, out);
+                    return;
+                }
+                in += size;
+            }
+        }
+
+        // header and room for one frame, nullptr if the image isn't packed
+        template <typename T>
+        inline T * scratch(const T * buffer)
+        {
+            if (!packed(buffer)) return nullptr;
+            T * copy = new T[headerSize(buffer) + frameSize(buffer)];
+            memcpy(copy, buffer, headerSize(buffer) * sizeof(T));
+            singleFrame(copy);
+            unpackFrame(buffer, 0, copy + headerSize(buffer));
+            return copy;
+        }
+    }
+
+    // packed images are drawn from their current frame, only unpacked by
+    // setFrame, so they don't animate by themselves
+    class Image : public ::Gamebuino_Meta::Image {
+    public:
+        using ::Gamebuino_Meta::Image::Image;
+        Image(const uint16_t * buffer) : Image(buffer, packing::scratch(buffer)) {}
+        Image(const uint8_t * buffer) : Image(buffer, packing::scratch(buffer)) {}
+        Image(const Image &) = delete;
+        ~Image()
+        {
+            delete[] words;
+            delete[] bytes;
+        }
+
+        // the Meta image isn't copied, its frame handler belongs to the other
+        // image: this one is built again from the same buffer, at its first
+        // frame (the transpiler only creates images from a buffer)
+        Image & operator=(const Image & other)
+        {
+            if (this != &other && (other.sourceWords || other.sourceBytes))
+            {
+                const uint16_t * sourceWords = other.sourceWords;
+                const uint8_t * sourceBytes = other.sourceBytes;
+                this->~Image();
+                if (sourceWords)
+                {
+                    new (this) Image(sourceWords);
+                }
+                else
+                {
+                    new (this) Image(sourceBytes);
+                }
+            }
+            return *this;
+        }
+
+        void setFrame(uint16_t frame)
+        {
+            if (words && frame < count)
+            {
+                packing::unpackFrame(sourceWords, frame, words + packing::headerSize(words));
+            }
+            else if (bytes && frame < count)
+            {
+                packing::unpackFrame(sourceBytes, frame, bytes + packing::headerSize(bytes));
+            }
+            else if (!words && !bytes)
+            {
+                ::Gamebuino_Meta::Image::setFrame(frame);
+            }
+        }
+
+    private:
+        Image(const uint16_t * buffer, uint16_t * scratch)
+            : ::Gamebuino_Meta::Image(scratch ? scratch : buffer), sourceWords(buffer), words(scratch), count(packing::frames(buffer))
+        {
+        }
+
+        Image(const uint8_t * buffer, uint8_t * scratch)
+            : ::Gamebuino_Meta::Image(scratch ? scratch : buffer), sourceBytes(buffer), bytes(scratch), count(packing::frames(buffer))
+        {
+        }
+
+        const uint16_t * sourceWords = nullptr; // the image in flash
+        const uint8_t * sourceBytes = nullptr;
+        uint16_t * words = nullptr; // header and current frame of a packed image
+        uint8_t * bytes = nullptr;
+        uint16_t count;
+    };
 }
 
 namespace std::std {
@@ -94,11 +256,11 @@ namespace std::std {
 }
 )___";
 
-    output_header.close();
+    writeIfChanged("gamebuino-java.h", output_header.str());
 
     if (resources.size())
     {
-        std::ofstream output_res_header(RESOURCES_FILE + ".h"s);
+        std::ostringstream output_res_header;
 
         output_res_header << "#include <cstdint>\n";
 
@@ -107,14 +269,16 @@ namespace std::std {
             if (fs::exists(currentPath / res.filename))
             {
                 output_res_header << "\n"
-                                  << "extern const " << ((res.format == Format::Rgb565) ? "uint16_t" : "uint8_t")
+                                  << "extern const " << resourceType(res.format)
                                   << " " << encode_filename(res.filename) << "[];\n";
             }
         }
 
-        output_res_header.close();
+        writeIfChanged(RESOURCES_FILE + ".h"s, output_res_header.str());
+
+        PaletteMapper palette(project.palette_option.size() ? loadPalette((currentPath / project.palette_option).string()) : defaultPalette());
 
-        std::ofstream output_res_source(RESOURCES_FILE + ".ino"s);
+        std::ostringstream output_res_source;
 
         output_res_source << "#include <cstdint>\n";
 
@@ -123,15 +287,15 @@ namespace std::std {
             if (fs::exists(currentPath / res.filename))
             {
                 output_res_source << "\n"
-                                  << "const " << ((res.format == Format::Rgb565) ? "uint16_t" : "uint8_t")
+                                  << "const " << resourceType(res.format)
                                   << " " << encode_filename(res.filename) << "[] = { ";
                 res.filename = currentPath.string() + "/" + res.filename;
-                encode_file(output_res_source, res);
+                encode_file(output_res_source, res, palette, project.dither);
                 output_res_source << " };\n";
             }
         }
 
-        output_res_source.close();
+        writeIfChanged(RESOURCES_FILE + ".ino"s, output_res_source.str());
     }
     else
     {
@@ -141,7 +305,26 @@ namespace std::std {
 
     copyUserFiles(currentPath);
 
-    auto ret = helpers::execute("arduino-cli", "compile --fqbn gamebuino:samd:gamebuino_meta_native --output-dir build");
+    // the extra flags of the core come after its own -Os
+    auto flags = getProfileFlags(project.profile());
+    if (flags.lto)
+    {
+        flags.compile += flags.compile.size() ? " -flto" : "-flto";
+        flags.link += flags.link.size() ? " -flto" : "-flto";
+    }
+
+    std::string properties;
+    if (flags.compile.size())
+    {
+        properties += fmt::format(" --build-property \"compiler.c.extra_flags={0}\""
+                                  " --build-property \"compiler.cpp.extra_flags={0}\"", flags.compile);
+    }
+    if (flags.link.size())
+    {
+        properties += fmt::format(" --build-property \"compiler.c.elf.extra_flags={}\"", flags.link);
+    }
+
+    auto ret = helpers::execute("arduino-cli", fmt::format("compile --fqbn gamebuino:samd:gamebuino_meta_native --jobs {}{} --output-dir build", jobs(), properties));
     if (!ret)
     {
         fmt::print("Error during the generation of the .bin file!");
@@ -161,9 +344,14 @@ namespace std::std {
     }
 }
 
-void add_resource(std::string filename, Format format, int yframes, int xframes, int loop)
+void add_resource(Resource res)
+{
+    resources.push_back(res);
+}
+
+void clear_resources()
 {
-    resources.emplace_back(filename, format, yframes, xframes, loop);
+    resources.clear();
 }
 
 std::string encode_filename(std::string filename)
@@ -174,27 +362,144 @@ std::string encode_filename(std::string filename)
     return filename;
 }
 
-uint8_t findNearestIndex(uint16_t colour)
+// LZ77 over the pixels of a frame, unpacked by gamebuino::packing::unpack
+static std::vector<uint16_t> pack(std::span<const uint16_t> in)
+{
+    constexpr size_t MIN_MATCH = 3; // shorter ones cost as much as literals
+    constexpr size_t MAX_MATCH = 255;
+    constexpr size_t MAX_LITERALS = 255;
+    constexpr size_t MAX_OFFSET = 0xFFFF;
+
+    std::vector<uint16_t> out;
+    std::unordered_map<uint32_t, size_t> last; // two pixels -> where they were last seen
+    size_t start = 0; // first literal not written yet
+
+    auto key = [&](size_t pos) { return in[pos] | (uint32_t(in[pos + 1]) << 16); };
+    auto emit = [&](size_t end, size_t length, size_t offset)
+    {
+        while (end - start > MAX_LITERALS)
+        {
+            out.push_back(MAX_LITERALS << 8);
+            out.insert(out.end(), in.begin() + start, in.begin() + start + MAX_LITERALS);
+            start += MAX_LITERALS;
+        }
+        out.push_back(((end - start) << 8) | length);
+        out.insert(out.end(), in.begin() + start, in.begin() + end);
+        if (length)
+        {
+            out.push_back(offset);
+        }
+        start = end + length;
+    };
+
+    size_t pos = 0;
+    while (pos + 1 < in.size())
+    {
+        size_t length = 0;
+        size_t from = 0;
+        if (auto it = last.find(key(pos)); it != last.end() && pos - it->second <= MAX_OFFSET)
+        {
+            from = it->second;
+            while (pos + length < in.size() && length < MAX_MATCH && in[from + length] == in[pos + length])
+            {
+                ++length;
+            }
+        }
+
+        if (length >= MIN_MATCH)
+        {
+            emit(pos, length, pos - from);
+            for (auto end = pos + length; pos < end; ++pos)
+            {
+                if (pos + 1 < in.size())
+                {
+                    last[key(pos)] = pos;
+                }
+            }
+        }
+        else
+        {
+            last[key(pos)] = pos;
+            ++pos;
+        }
+    }
+
+    if (start < in.size())
+    {
+        emit(in.size(), 0, 0);
+    }
+
+    return out;
+}
+
+// PackBits over the bytes of a frame, unpacked by gamebuino::packing::unpack
+static std::vector<uint8_t> pack(std::span<const uint8_t> in)
 {
-    return colour & 0xF;
+    constexpr size_t MIN_RUN = 3;
+    constexpr size_t MAX_RUN = 129;
+    constexpr size_t MAX_LITERALS = 128;
+
+    std::vector<uint8_t> out;
+    auto runAt = [&](size_t pos)
+    {
+        size_t run = 1;
+        while (pos + run < in.size() && run < MAX_RUN && in[pos + run] == in[pos])
+        {
+            ++run;
+        }
+        return run;
+    };
+
+    size_t pos = 0;
+    while (pos < in.size())
+    {
+        if (auto run = runAt(pos); run >= MIN_RUN)
+        {
+            out.push_back(run + 126);
+            out.push_back(in[pos]);
+            pos += run;
+        }
+        else
+        {
+            auto end = pos + 1;
+            while (end < in.size() && end - pos < MAX_LITERALS && runAt(end) < MIN_RUN)
+            {
+                ++end;
+            }
+            out.push_back(end - pos - 1);
+            out.insert(out.end(), in.begin() + pos, in.begin() + end);
+            pos = end;
+        }
+    }
+
+    return out;
 }
 
-uint16_t rgb32_to_565(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+template<typename T>
+static void write_frame(std::ostream & stream, const std::vector<T> & frame, bool packed)
 {
-    if (a < 128)
+    if (!packed)
     {
-        r = 255;
-        g = 0;
-        b = 255;
+        write_hex(stream, std::span<const T>(frame));
+        return;
     }
 
-    return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+    auto data = pack(std::span<const T>(frame));
+    constexpr auto bits = 8 * sizeof(T);
+    if (data.size() >> (2 * bits))
+    {
+        throw fmt::format("A frame is too large to be packed ({} elements).", data.size());
+    }
+
+    stream << ", " << (data.size() & ((1u << bits) - 1)) << ", " << (data.size() >> bits);
+    write_frame(stream, data, false);
 }
 
-void encode_file(std::ofstream & stream, Resource res)
+void encode_file(std::ostream & stream, Resource res, const PaletteMapper & palette, Dither dither)
 {
     int x, y, comp;
-    if (!stbi_info(res.filename.data(), &x, &y, &comp))
+    auto data = stbi_load(res.filename.data(), &x, &y, &comp, 4);
+    if (!data)
     {
         throw fmt::format("Can't read '{}'.", res.filename);
     }
@@ -202,9 +507,16 @@ void encode_file(std::ofstream & stream, Resource res)
     int width = x / res.xcount;
     int height = y / res.ycount;
     int framesCount = res.xcount * res.ycount;
+    bool indexed = isIndexed(res.format);
+    bool packed = isPacked(res.format);
+    if (packed && res.loop > 0)
+    {
+        // the library steps through the frames while drawing, it can't unpack them
+        throw fmt::format("'{}' is packed, it can't loop: its frames are chosen with setFrame().", res.filename);
+    }
 
     stream << width << ", " << height << ", ";
-    if (res.format == Format::Indexed)
+    if (indexed)
     {
         stream << (framesCount & 0xFF) << ", " << ((framesCount >> 8) & 0xFF);
     }
@@ -213,12 +525,10 @@ void encode_file(std::ofstream & stream, Resource res)
         stream << framesCount;
     }
     stream << ", " << res.loop
-           << ", " << ((res.format == Format::Indexed) ? "0xFF" : fmt::format("0x{:x}", rgb32_to_565(255, 0, 255, 255)))
-           << ", " << std::to_underlying(res.format);
-
-    auto data = stbi_load(res.filename.data(), &x, &y, &comp, comp);
+           << ", " << (indexed ? "0xFF" : fmt::format("0x{:x}", rgb32_to_565(255, 0, 255, 255)))
+           << ", " << ((indexed ? 1 : 0) | (packed ? 0x80 : 0));
 
-    assert(comp == 4);
+    auto pixel = [&](int px, int py) { return &data[(py * x + px) * 4]; };
 
     for (int iy = 0; iy < res.ycount; ++iy)
     {
@@ -227,39 +537,33 @@ void encode_file(std::ofstream & stream, Resource res)
             int fx = ix * width;
             int fy = iy * height;
 
-            for (int dy = fy; dy < fy + height; ++dy)
+            if (indexed)
             {
-                auto ptr = &data[dy * x * 4 + fx];
-                for (int dx = fx; dx < fx + width; ++dx)
+                // two pixels per byte, rows padded to a whole byte
+                auto indices = palette.map(pixel(fx, fy), x, width, height, dither);
+                std::vector<uint8_t> frame;
+                for (int dy = 0; dy < height; ++dy)
                 {
-                    if (res.format == Format::Indexed)
+                    auto row = &indices[dy * width];
+                    for (int dx = 0; dx < width; dx += 2)
                     {
-                        auto r1 = *ptr++;
-                        auto g1 = *ptr++;
-                        auto b1 = *ptr++;
-                        [[maybe_unused]] auto a1 = *ptr++;
-
-                        auto r2 = *ptr++;
-                        auto g2 = *ptr++;
-                        auto b2 = *ptr++;
-                        [[maybe_unused]] auto a2 = *ptr++;
-
-                        uint16_t colour1 = ((r1 >> 3) << 11) | ((g1 >> 2) << 5) | (b1 >> 3);
-                        uint16_t colour2 = ((r2 >> 3) << 11) | ((g2 >> 2) << 5) | (b2 >> 3);
-                        stream << ", " << fmt::format("0x{:x}{:x}", findNearestIndex(colour1), findNearestIndex(colour2));
-                    }
-                    else
-                    {
-                        auto r = *ptr++;
-                        auto g = *ptr++;
-                        auto b = *ptr++;
-                        auto a = *ptr++;
-
-                        uint16_t colour = rgb32_to_565(r, g, b, a);
-                        stream << ", " << fmt::format("0x{:x}", colour);
+                        uint8_t second = (dx + 1 < width) ? row[dx + 1] : 0;
+                        frame.push_back((row[dx] << 4) | second);
                     }
                 }
+                write_frame(stream, frame, packed);
+            }
+            else
+            {
+                std::vector<uint16_t> frame(width * height);
+                for (int dy = 0; dy < height; ++dy)
+                {
+                    rgba_to_565(pixel(fx, fy + dy), width, &frame[dy * width]);
+                }
+                write_frame(stream, frame, packed);
             }
         }
     }
+
+    stbi_image_free(data);
 }
@@ -3,8 +3,11 @@
 
 #include "classfile.h"
 
-void add_resource(std::string filename, Format format, int yframes = 1, int xframes = 1, int loop = 0);
+class Project;
+
+void add_resource(Resource res);
+void clear_resources();
 std::string encode_filename(std::string filename);
-void build_gamebuino(std::string project_name, std::vector<ClassFile> files);
+void build_gamebuino(Project & project);
 
 #endif // GAMEBUINO_H
@@ -0,0 +1,196 @@
+#include "palette.h"
+#include "pixels.h"
+#include "stb_image.h"
+#include <fmt/format.h>
+
+static Rgb expand565(uint16_t colour)
+{
+    int r = (colour >> 11) & 0x1F;
+    int g = (colour >> 5) & 0x3F;
+    int b = colour & 0x1F;
+
+    return { static_cast<uint8_t>((r << 3) | (r >> 2)), static_cast<uint8_t>((g << 2) | (g >> 4)), static_cast<uint8_t>((b << 3) | (b >> 2)) };
+}
+
+// "redmean" approximation of the perceived distance, weights the channels
+// depending on how red the colours are
+static int distance(const Rgb & a, const Rgb & b)
+{
+    int mean = (a[0] + b[0]) / 2;
+    int dr = a[0] - b[0];
+    int dg = a[1] - b[1];
+    int db = a[2] - b[2];
+
+    return (((512 + mean) * dr * dr) >> 8) + 4 * dg * dg + (((767 - mean) * db * db) >> 8);
+}
+
+PaletteMapper::PaletteMapper(std::vector<Rgb> colours)
+    : colours(std::move(colours))
+    , table(1 << 15)
+{
+    if (this->colours.empty() || this->colours.size() > 16)
+    {
+        throw fmt::format("A palette has 1 to 16 colours, not {}.", this->colours.size());
+    }
+
+    for (size_t colour = 0; colour < table.size(); ++colour)
+    {
+        int r = (colour >> 10) & 0x1F;
+        int g = (colour >> 5) & 0x1F;
+        int b = colour & 0x1F;
+        Rgb rgb = { static_cast<uint8_t>((r << 3) | (r >> 2)), static_cast<uint8_t>((g << 3) | (g >> 2)), static_cast<uint8_t>((b << 3) | (b >> 2)) };
+
+        int best = std::numeric_limits<int>::max();
+        for (size_t index = 0; index < this->colours.size(); ++index)
+        {
+            if (auto d = distance(rgb, this->colours[index]); d < best)
+            {
+                best = d;
+                table[colour] = index;
+            }
+        }
+    }
+}
+
+uint8_t PaletteMapper::nearest(int r, int g, int b) const
+{
+    r = std::clamp(r, 0, 255);
+    g = std::clamp(g, 0, 255);
+    b = std::clamp(b, 0, 255);
+
+    return table[((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3)];
+}
+
+std::vector<uint8_t> PaletteMapper::map(const uint8_t * rgba, int stride, int width, int height, Dither dither) const
+{
+    static constexpr int bayer[4][4] = {
+        {  0,  8,  2, 10 },
+        { 12,  4, 14,  6 },
+        {  3, 11,  1,  9 },
+        { 15,  7, 13,  5 },
+    };
+
+    std::vector<uint8_t> indices;
+    indices.reserve(width * height);
+
+    if (dither == Dither::None)
+    {
+        // the colours of a whole row at once, then one lookup per pixel
+        std::vector<uint16_t> keys(width);
+        for (int y = 0; y < height; ++y)
+        {
+            rgba_to_555(rgba + y * stride * 4, width, keys.data());
+            for (auto key : keys)
+            {
+                indices.push_back(table[key]);
+            }
+        }
+
+        return indices;
+    }
+
+    // Floyd-Steinberg: error of the current and next rows, in 16ths, one
+    // pixel of margin on each side
+    std::vector<std::array<int, 3>> error(width + 2), next(width + 2);
+
+    for (int y = 0; y < height; ++y)
+    {
+        auto row = rgba + y * stride * 4;
+        for (int x = 0; x < width; ++x)
+        {
+            int r = row[x * 4 + 0];
+            int g = row[x * 4 + 1];
+            int b = row[x * 4 + 2];
+
+            if (dither == Dither::Ordered)
+            {
+                // about a quarter of the gap between the 16 colours, centred
+                int offset = (2 * bayer[y & 3][x & 3] - 15) * 2;
+                r += offset;
+                g += offset;
+                b += offset;
+            }
+            else if (dither == Dither::FloydSteinberg)
+            {
+                r += error[x + 1][0] / 16;
+                g += error[x + 1][1] / 16;
+                b += error[x + 1][2] / 16;
+            }
+
+            auto index = nearest(r, g, b);
+            indices.push_back(index);
+
+            if (dither == Dither::FloydSteinberg)
+            {
+                auto & colour = colours[index];
+                int diff[3] = { std::clamp(r, 0, 255) - colour[0], std::clamp(g, 0, 255) - colour[1], std::clamp(b, 0, 255) - colour[2] };
+                for (int c = 0; c < 3; ++c)
+                {
+                    error[x + 2][c] += diff[c] * 7;
+                    next[x][c] += diff[c] * 3;
+                    next[x + 1][c] += diff[c] * 5;
+                    next[x + 2][c] += diff[c];
+                }
+            }
+        }
+
+        if (dither == Dither::FloydSteinberg)
+        {
+            std::swap(error, next);
+            std::fill(next.begin(), next.end(), std::array<int, 3>{});
+        }
+    }
+
+    return indices;
+}
+
+std::vector<Rgb> defaultPalette()
+{
+    // Gamebuino_Meta::Color, in the order of gamebuino.Color
+    static constexpr uint16_t colours[16] = {
+        0xffff, // white
+        0xacd0, // gray
+        0x5268, // darkgray
+        0x0000, // black
+        0x633f, // purple
+        0xd112, // pink
+        0xd8e4, // red
+        0xfd42, // orange
+        0xcc68, // brown
+        0xfeb2, // beige
+        0xf720, // yellow
+        0x8668, // lightgreen
+        0x07e0, // green
+        0x0215, // darkblue
+        0x041f, // blue
+        0x7ddf, // lightblue
+    };
+
+    std::vector<Rgb> palette;
+    for (auto colour : colours)
+    {
+        palette.push_back(expand565(colour));
+    }
+
+    return palette;
+}
+
+std::vector<Rgb> loadPalette(const std::string & filename)
+{
+    int x, y, comp;
+    auto data = stbi_load(filename.data(), &x, &y, &comp, 3);
+    if (!data)
+    {
+        throw fmt::format("Can't read '{}'.", filename);
+    }
+
+    std::vector<Rgb> palette;
+    for (int index = 0; index < x * y; ++index)
+    {
+        palette.push_back({ data[index * 3], data[index * 3 + 1], data[index * 3 + 2] });
+    }
+
+    stbi_image_free(data);
+
+    return palette;
+}
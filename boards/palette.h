@@ -0,0 +1,29 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include "globals.h"
+#include <array>
+
+using Rgb = std::array<uint8_t, 3>;
+
+// Colours of the Indexed images of the Gamebuino, 16 at most.
+// The nearest colour of each RGB555 colour is computed once, so mapping a
+// pixel is a lookup.
+class PaletteMapper
+{
+public:
+    PaletteMapper(std::vector<Rgb> colours);
+
+    uint8_t nearest(int r, int g, int b) const; // channels are clamped to 0..255
+    // one index per pixel of the width x height rectangle of an RGBA image
+    // whose rows are "stride" pixels long
+    std::vector<uint8_t> map(const uint8_t * rgba, int stride, int width, int height, Dither dither) const;
+
+    std::vector<Rgb> colours;
+    std::vector<uint8_t> table; // RGB555 -> index
+};
+
+std::vector<Rgb> defaultPalette(); // of the Gamebuino META
+std::vector<Rgb> loadPalette(const std::string & filename); // every pixel of the image, in order
+
+#endif // PALETTE_H
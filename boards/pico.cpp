@@ -1,6 +1,11 @@
 #include "pico.h"
+#include "buildcache.h"
+#include "project.h"
+#include "parallel.h"
+#include "helpers.h"
 #include "globals.h"
 #include <fstream>
+#include <sstream>
 #include <filesystem>
 #include <fmt/format.h>
 
@@ -8,8 +13,10 @@ std::set<std::string> usedFieldNames;
 
 std::string get_cmake_board_name(Board board);
 
-void build_pico(std::string project_name, Board board, std::vector<ClassFile> files)
+void build_pico(Project & project, Board board)
 {
+    auto & project_name = project.name;
+
     if (!getenv("PICO_SDK_PATH"))
     {
         fmt::print("$PICO_SDK_PATH is not set nor accessible. Aborting.\n");
@@ -33,12 +40,9 @@ void build_pico(std::string project_name, Board board, std::vector<ClassFile> fi
     fs::create_directories(tempDir + "/build");
     fs::current_path(tempPath / tempDir);
 
-    for (auto & file : files)
-    {
-        file.generate(files, board);
-    }
+    project.generate(board);
 
-    std::ofstream output_cmake("CMakeLists.txt");
+    std::ostringstream output_cmake;
 
     std::string libs;
     if (board == Board::PicoW)
@@ -60,7 +64,7 @@ void build_pico(std::string project_name, Board board, std::vector<ClassFile> fi
     output_cmake << fmt::format("project({})\n", project_name)
                  << "pico_sdk_init()\n"
                  << fmt::format("add_executable({}", project_name);
-    for (auto & file : files)
+    for (auto & file : project.sources)
     {
         output_cmake << " " << file.fileName << ".cpp";
     }
@@ -72,9 +76,10 @@ void build_pico(std::string project_name, Board board, std::vector<ClassFile> fi
         libs = "badger2040 hardware_spi";
     }
     output_cmake << fmt::format("target_link_libraries({} pico_stdlib {})\n", project_name, libs);
-    output_cmake.close();
+    output_cmake << cmake_profile(project.profile(), project_name);
+    bool configure = writeIfChanged("CMakeLists.txt", output_cmake.str());
 
-    std::ofstream output_header("pico-java.h");
+    std::ostringstream output_header;
 
     output_header << R"___(
 #ifndef PICO_JAVA_H
@@ -276,16 +281,91 @@ namespace pimoroni
 
     output_header << "#endif\n";
 
-    output_header.close();
+    writeIfChanged("pico-java.h", output_header.str());
 
     copyUserFiles(currentPath);
 
-    fs::current_path(tempPath / tempDir / "build");
-    system("cmake ..");
-    system("make");
+    cmake_build(configure);
     system(fmt::format("cp {}.uf2 {}", project_name, currentPath.string()).data());
 }
 
+void cmake_build(bool configure)
+{
+    bool ninja = helpers::can_execute("ninja");
+
+    fs::current_path("build");
+
+    // the generator of a configured directory can't be changed
+    if (fs::exists("CMakeCache.txt"))
+    {
+        std::ifstream cache("CMakeCache.txt");
+        std::string line;
+        bool configuredNinja = false;
+        while (std::getline(cache, line))
+        {
+            configuredNinja |= (line == "CMAKE_GENERATOR:INTERNAL=Ninja");
+        }
+        cache.close();
+
+        if (configuredNinja != ninja)
+        {
+            fs::remove("CMakeCache.txt");
+            fs::remove_all("CMakeFiles");
+        }
+    }
+
+    if (configure || !fs::exists("CMakeCache.txt"))
+    {
+        std::string options;
+        if (ninja)
+        {
+            options += " -G Ninja";
+        }
+
+        // $PICO_JAVA_LAUNCHER overrides ccache, set it empty to disable it
+        auto env = getenv("PICO_JAVA_LAUNCHER");
+        std::string launcher = env ? env : (helpers::can_execute("ccache") ? "ccache" : "");
+        if (launcher.size())
+        {
+            options += fmt::format(" -DCMAKE_C_COMPILER_LAUNCHER={0} -DCMAKE_CXX_COMPILER_LAUNCHER={0}", launcher);
+        }
+
+        system(fmt::format("cmake{} ..", options).data());
+    }
+
+    // one cache for every project, paths made relative to the temp directory
+    // so that the SDK objects are shared between them
+    auto tempPath = fs::temp_directory_path();
+    if (!getenv("CCACHE_DIR"))
+    {
+        helpers::set_env("CCACHE_DIR", (tempPath / "pico-java-ccache").string());
+    }
+    helpers::set_env("CCACHE_BASEDIR", tempPath.string());
+    helpers::set_env("CCACHE_NOHASHDIR", "1");
+
+    system(fmt::format("{} -j{}", ninja ? "ninja" : "make", jobs()).data());
+}
+
+std::string cmake_profile(Profile profile, std::string_view target)
+{
+    auto flags = getProfileFlags(profile);
+
+    std::string output;
+    if (flags.compile.size())
+    {
+        output += fmt::format("target_compile_options({} PRIVATE {})\n", target, flags.compile);
+    }
+    if (flags.link.size())
+    {
+        output += fmt::format("target_link_options({} PRIVATE {})\n", target, flags.link);
+    }
+    if (flags.lto)
+    {
+        output += fmt::format("set_property(TARGET {} PROPERTY INTERPROCEDURAL_OPTIMIZATION TRUE)\n", target);
+    }
+    return output;
+}
+
 std::string get_cmake_board_name(Board board)
 {
     if (board == Board::Pico)         return "pico";
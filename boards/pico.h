@@ -1,8 +1,13 @@
 #ifndef PICO_H
 #define PICO_H
 
-#include "classfile.h"
+#include "project.h"
 
-void build_pico(std::string project_name, Board board, std::vector<ClassFile> files);
+void build_pico(Project & project, Board board);
+// configures the CMake project of the current directory if needed, then
+// builds it in "build" with Ninja if available, using jobs() threads
+void cmake_build(bool configure);
+// options of the build profile for a CMake target, none for the default one
+std::string cmake_profile(Profile profile, std::string_view target);
 
 #endif // PICO_H
@@ -1,7 +1,13 @@
 #include "picosystem.h"
+#include "pico.h"
+#include "buildcache.h"
+#include "project.h"
+#include <sstream>
 
-void build_picosystem(std::string project_name, std::vector<ClassFile> files)
+void build_picosystem(Project & project)
 {
+    auto & project_name = project.name;
+
     if (!getenv("PICO_SDK_PATH"))
     {
         fmt::print("$PICO_SDK_PATH is not set nor accessible. Aborting.\n");
@@ -22,12 +28,9 @@ void build_picosystem(std::string project_name, std::vector<ClassFile> files)
     fs::create_directories(tempDir + "/build");
     fs::current_path(tempPath / tempDir);
 
-    for (auto & file : files)
-    {
-        file.generate(files, Board::Picosystem);
-    }
+    project.generate(Board::Picosystem);
 
-    std::ofstream output_cmake("CMakeLists.txt");
+    std::ostringstream output_cmake;
 
     output_cmake << R"___(
 cmake_minimum_required(VERSION 3.12)
@@ -45,7 +48,7 @@ set(PROJECT_NAME
 set(PROJECT_SOURCES
 )___";
 
-    for (auto & file : files)
+    for (auto & file : project.sources)
     {
         output_cmake << "    " << file.fileName << ".cpp\n";
     }
@@ -83,7 +86,7 @@ picosystem_executable(
 )
 )___";
 
-    for (auto & file : files)
+    for (auto & file : project.sources)
     {
         for (auto & str : file.rawCMake)
         {
@@ -91,9 +94,11 @@ picosystem_executable(
         }
     }
 
-    output_cmake.close();
+    output_cmake << cmake_profile(project.profile(), "${PROJECT_NAME}");
+
+    bool configure = writeIfChanged("CMakeLists.txt", output_cmake.str());
 
-    std::ofstream output_header("picosystem-java.h");
+    std::ostringstream output_header;
 
     output_header << R"___(
 #ifndef PICOSYSTEM_JAVA_H
@@ -116,13 +121,11 @@ namespace pimoroni {
 #endif
 )___";
 
-    output_header.close();
+    writeIfChanged("picosystem-java.h", output_header.str());
 
     copyUserFiles(currentPath);
 
     //return;
-    fs::current_path(tempPath / tempDir / "build");
-    system("cmake ..");
-    system("make");
+    cmake_build(configure);
     system(fmt::format("cp {}.uf2 {}", project_name, currentPath.string()).data());
 }
@@ -1,8 +1,8 @@
 #ifndef PICOSYSTEM_H
 #define PICOSYSTEM_H
 
-#include "classfile.h"
+#include "project.h"
 
-void build_picosystem(std::string project_name, std::vector<ClassFile> files);
+void build_picosystem(Project & project);
 
 #endif // PICOSYSTEM_H
@@ -0,0 +1,205 @@
+#include "pixels.h"
+#include <array>
+#include <cstring>
+#include <ostream>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PIXELS_X86
+#endif
+
+static void rgba_to_565_scalar(const uint8_t * rgba, size_t count, uint16_t * out)
+{
+    for (size_t index = 0; index < count; ++index, rgba += 4)
+    {
+        out[index] = rgb32_to_565(rgba[0], rgba[1], rgba[2], rgba[3]);
+    }
+}
+
+static void rgba_to_555_scalar(const uint8_t * rgba, size_t count, uint16_t * out)
+{
+    for (size_t index = 0; index < count; ++index, rgba += 4)
+    {
+        out[index] = ((rgba[0] >> 3) << 10) | ((rgba[1] >> 3) << 5) | (rgba[2] >> 3);
+    }
+}
+
+#ifdef PIXELS_X86
+
+// pixels are little endian 32-bit lanes: r | g << 8 | b << 16 | a << 24
+
+__attribute__((target("sse2")))
+static __m128i pack565(__m128i pixels)
+{
+    auto r = _mm_and_si128(_mm_srli_epi32(pixels, 3), _mm_set1_epi32(0x1F));
+    auto g = _mm_and_si128(_mm_srli_epi32(pixels, 10), _mm_set1_epi32(0x3F));
+    auto b = _mm_and_si128(_mm_srli_epi32(pixels, 19), _mm_set1_epi32(0x1F));
+    auto colour = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 11), _mm_slli_epi32(g, 5)), b);
+
+    auto transparent = _mm_cmplt_epi32(_mm_srli_epi32(pixels, 24), _mm_set1_epi32(128));
+    colour = _mm_or_si128(_mm_andnot_si128(transparent, colour), _mm_and_si128(transparent, _mm_set1_epi32(0xF81F)));
+
+    // sign extended so packs keeps the 16 bits as they are
+    return _mm_srai_epi32(_mm_slli_epi32(colour, 16), 16);
+}
+
+__attribute__((target("sse2")))
+static __m128i pack555(__m128i pixels)
+{
+    auto r = _mm_and_si128(_mm_srli_epi32(pixels, 3), _mm_set1_epi32(0x1F));
+    auto g = _mm_and_si128(_mm_srli_epi32(pixels, 11), _mm_set1_epi32(0x1F));
+    auto b = _mm_and_si128(_mm_srli_epi32(pixels, 19), _mm_set1_epi32(0x1F));
+
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 10), _mm_slli_epi32(g, 5)), b);
+}
+
+template<__m128i (*Pack)(__m128i)>
+__attribute__((target("sse2")))
+static size_t convert_sse2(const uint8_t * rgba, size_t count, uint16_t * out)
+{
+    size_t index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        auto low = Pack(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rgba + index * 4)));
+        auto high = Pack(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rgba + index * 4 + 16)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + index), _mm_packs_epi32(low, high));
+    }
+
+    return index;
+}
+
+__attribute__((target("avx2")))
+static __m256i pack565_avx2(__m256i pixels)
+{
+    auto r = _mm256_and_si256(_mm256_srli_epi32(pixels, 3), _mm256_set1_epi32(0x1F));
+    auto g = _mm256_and_si256(_mm256_srli_epi32(pixels, 10), _mm256_set1_epi32(0x3F));
+    auto b = _mm256_and_si256(_mm256_srli_epi32(pixels, 19), _mm256_set1_epi32(0x1F));
+    auto colour = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 11), _mm256_slli_epi32(g, 5)), b);
+
+    auto transparent = _mm256_cmpgt_epi32(_mm256_set1_epi32(128), _mm256_srli_epi32(pixels, 24));
+    return _mm256_blendv_epi8(colour, _mm256_set1_epi32(0xF81F), transparent);
+}
+
+__attribute__((target("avx2")))
+static __m256i pack555_avx2(__m256i pixels)
+{
+    auto r = _mm256_and_si256(_mm256_srli_epi32(pixels, 3), _mm256_set1_epi32(0x1F));
+    auto g = _mm256_and_si256(_mm256_srli_epi32(pixels, 11), _mm256_set1_epi32(0x1F));
+    auto b = _mm256_and_si256(_mm256_srli_epi32(pixels, 19), _mm256_set1_epi32(0x1F));
+
+    return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 10), _mm256_slli_epi32(g, 5)), b);
+}
+
+template<__m256i (*Pack)(__m256i)>
+__attribute__((target("avx2")))
+static size_t convert_avx2(const uint8_t * rgba, size_t count, uint16_t * out)
+{
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16)
+    {
+        auto low = Pack(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(rgba + index * 4)));
+        auto high = Pack(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(rgba + index * 4 + 32)));
+        // packus works on each 128-bit half, the permutation puts the pixels back in order
+        auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + index), packed);
+    }
+
+    return index;
+}
+
+static bool has_avx2()
+{
+    static bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+#endif // PIXELS_X86
+
+void rgba_to_565(const uint8_t * rgba, size_t count, uint16_t * out)
+{
+    size_t done = 0;
+#ifdef PIXELS_X86
+    done = has_avx2() ? convert_avx2<pack565_avx2>(rgba, count, out) : convert_sse2<pack565>(rgba, count, out);
+#endif
+    rgba_to_565_scalar(rgba + done * 4, count - done, out + done);
+}
+
+void rgba_to_555(const uint8_t * rgba, size_t count, uint16_t * out)
+{
+    size_t done = 0;
+#ifdef PIXELS_X86
+    done = has_avx2() ? convert_avx2<pack555_avx2>(rgba, count, out) : convert_sse2<pack555>(rgba, count, out);
+#endif
+    rgba_to_555_scalar(rgba + done * 4, count - done, out + done);
+}
+
+// ", 0x" and the digits of a byte without leading zeros, or its 2 digits
+struct HexTable
+{
+    std::array<std::array<char, 6>, 256> text;
+    std::array<uint8_t, 256> length;
+    std::array<std::array<char, 2>, 256> digits;
+
+    HexTable()
+    {
+        constexpr char hex[] = "0123456789abcdef";
+        for (int value = 0; value < 256; ++value)
+        {
+            text[value] = { ',', ' ', '0', 'x', hex[value >> 4], hex[value & 0xF] };
+            length[value] = 6;
+            if (value < 16)
+            {
+                text[value][4] = hex[value];
+                length[value] = 5;
+            }
+            digits[value] = { hex[value >> 4], hex[value & 0xF] };
+        }
+    }
+};
+
+static const HexTable hexTable;
+
+// the text goes through a buffer written in chunks of about that size
+constexpr size_t HEX_CHUNK = 64 * 1024;
+
+template<typename T>
+static void write_hex_values(std::ostream & stream, std::span<const T> values)
+{
+    char buffer[HEX_CHUNK + 8];
+    size_t used = 0;
+    for (auto value : values)
+    {
+        auto high = value >> 8;
+        auto low = value & 0xFF;
+        if (high)
+        {
+            std::memcpy(buffer + used, hexTable.text[high].data(), hexTable.length[high]);
+            used += hexTable.length[high];
+            std::memcpy(buffer + used, hexTable.digits[low].data(), 2);
+            used += 2;
+        }
+        else
+        {
+            std::memcpy(buffer + used, hexTable.text[low].data(), hexTable.length[low]);
+            used += hexTable.length[low];
+        }
+
+        if (used >= HEX_CHUNK)
+        {
+            stream.write(buffer, used);
+            used = 0;
+        }
+    }
+
+    stream.write(buffer, used);
+}
+
+void write_hex(std::ostream & stream, std::span<const uint16_t> values)
+{
+    write_hex_values(stream, values);
+}
+
+void write_hex(std::ostream & stream, std::span<const uint8_t> values)
+{
+    write_hex_values(stream, values);
+}
@@ -0,0 +1,29 @@
+#ifndef PIXELS_H
+#define PIXELS_H
+
+#include "globals.h"
+
+// Conversions of rows of RGBA pixels, with SSE2 or AVX2 when the CPU has them.
+
+inline uint16_t rgb32_to_565(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    if (a < 128)
+    {
+        r = 255;
+        g = 0;
+        b = 255;
+    }
+
+    return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+}
+
+// RGB565, transparent pixels (alpha < 128) are magenta
+void rgba_to_565(const uint8_t * rgba, size_t count, uint16_t * out);
+// RGB555 without the alpha, index of the tables of PaletteMapper
+void rgba_to_555(const uint8_t * rgba, size_t count, uint16_t * out);
+
+// ", 0x..." for each value, lowercase without leading zeros
+void write_hex(std::ostream & stream, std::span<const uint16_t> values);
+void write_hex(std::ostream & stream, std::span<const uint8_t> values);
+
+#endif // PIXELS_H
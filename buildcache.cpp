@@ -0,0 +1,155 @@
+#include "buildcache.h"
+#include <sstream>
+
+// bumped whenever the generated code changes for a same class file
+constexpr int CACHE_VERSION = 7;
+
+u8 hashBytes(std::span<const u1> bytes, u8 seed)
+{
+    for (auto b : bytes)
+    {
+        seed = (seed ^ b) * 0x100000001b3;
+    }
+    return seed;
+}
+
+u8 hashString(std::string_view str, u8 seed)
+{
+    return hashBytes({ reinterpret_cast<const u1 *>(str.data()), str.size() }, seed);
+}
+
+static std::optional<std::string> readFile(const fs::path & path)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+    {
+        return {};
+    }
+
+    std::ostringstream content;
+    content << input.rdbuf();
+    return content.str();
+}
+
+bool writeIfChanged(const fs::path & path, const std::string & content)
+{
+    if (readFile(path) == content)
+    {
+        return false;
+    }
+
+    std::ofstream output(path, std::ios::binary);
+    output << content;
+    output.close();
+
+    if (!output)
+    {
+        throw fmt::format("Can't write '{}'.", path.string());
+    }
+
+    return true;
+}
+
+BuildCache::BuildCache(fs::path directory)
+    : directory(directory)
+{
+    std::ifstream input(directory / CACHE_FILE);
+
+    std::string header;
+    int version = 0;
+    if (!(input >> header >> version) || header != "pico-java" || version != CACHE_VERSION)
+    {
+        return;
+    }
+
+    Entry * entry = nullptr;
+    std::string kind;
+    while (input >> kind)
+    {
+        if (kind == "source")
+        {
+            u8 key;
+            std::string source;
+            input >> std::hex >> key >> std::dec >> std::ws;
+            std::getline(input, source);
+            entry = &entries[source];
+            entry->key = key;
+        }
+        else if (kind == "output" && entry)
+        {
+            u8 hash;
+            std::string filename;
+            input >> std::hex >> hash >> std::dec >> std::ws;
+            std::getline(input, filename);
+            entry->outputs.emplace_back(filename, hash);
+        }
+        else if (kind == "resource" && entry)
+        {
+            int format;
+            Resource res;
+            input >> format >> res.xcount >> res.ycount >> res.loop >> std::ws;
+            std::getline(input, res.filename);
+            res.format = static_cast<Format>(format);
+            entry->resources.push_back(res);
+        }
+        else
+        {
+            // unknown or corrupted cache, start from scratch
+            entries.clear();
+            return;
+        }
+    }
+}
+
+const BuildCache::Entry * BuildCache::find(const std::string & source, u8 key) const
+{
+    auto it = entries.find(source);
+    if (it == entries.end() || it->second.key != key)
+    {
+        return nullptr;
+    }
+
+    for (auto & [filename, hash] : it->second.outputs)
+    {
+        auto content = readFile(directory / filename);
+        if (!content || hashString(*content) != hash)
+        {
+            return nullptr;
+        }
+    }
+
+    return &it->second;
+}
+
+void BuildCache::store(const std::string & source, u8 key, const std::vector<std::string> & outputs, const std::vector<Resource> & resources)
+{
+    Entry entry { key, {}, resources };
+    for (auto & filename : outputs)
+    {
+        entry.outputs.emplace_back(filename, hashString(readFile(directory / filename).value_or("")));
+    }
+
+    entries[source] = std::move(entry);
+}
+
+void BuildCache::save() const
+{
+    std::ostringstream output;
+    output << "pico-java " << CACHE_VERSION << '\n';
+
+    for (auto & [source, entry] : entries)
+    {
+        output << "source " << std::hex << entry.key << std::dec << ' ' << source << '\n';
+        for (auto & [filename, hash] : entry.outputs)
+        {
+            output << "output " << std::hex << hash << std::dec << ' ' << filename << '\n';
+        }
+        for (auto & res : entry.resources)
+        {
+            output << "resource " << std::to_underlying(res.format) << ' ' << res.xcount << ' '
+                   << res.ycount << ' ' << res.loop << ' ' << res.filename << '\n';
+        }
+    }
+
+    writeIfChanged(directory / CACHE_FILE, output.str());
+}
@@ -0,0 +1,40 @@
+#ifndef BUILDCACHE_H
+#define BUILDCACHE_H
+
+#include "globals.h"
+#include <map>
+
+constexpr const char* CACHE_FILE = ".pico-java.cache";
+
+// 64-bit FNV-1a, chain the calls by passing the previous hash as seed
+u8 hashBytes(std::span<const u1> bytes, u8 seed = 0xcbf29ce484222325);
+u8 hashString(std::string_view str, u8 seed = 0xcbf29ce484222325);
+
+// Writes the file only if its content differs, so its mtime is kept and
+// make doesn't rebuild it. Returns true if the file was written.
+bool writeIfChanged(const fs::path & path, const std::string & content);
+
+// What was generated for each source in a build directory by the previous run.
+// A source whose key didn't change and whose outputs are untouched on disk
+// doesn't need to be decompiled nor generated again.
+class BuildCache
+{
+public:
+    struct Entry
+    {
+        u8 key = 0;
+        std::vector<std::pair<std::string, u8>> outputs; // filename, content hash
+        std::vector<Resource> resources;
+    };
+
+    BuildCache(fs::path directory);
+
+    const Entry * find(const std::string & source, u8 key) const;
+    void store(const std::string & source, u8 key, const std::vector<std::string> & outputs, const std::vector<Resource> & resources);
+    void save() const;
+
+    fs::path directory;
+    std::map<std::string, Entry> entries;
+};
+
+#endif // BUILDCACHE_H
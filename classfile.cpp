@@ -1,23 +1,15 @@
 #include "classfile.h"
 #include "boards/gamebuino.h"
+#include "helpers.h"
+#include "project.h"
+#include "parallel.h"
+#include "buildcache.h"
+#include "interner.h"
+#include "staticinit.h"
 #include "boost/algorithm/string.hpp"
 #include <fstream>
-
-enum
-{
-    T_NONE    = 0,
-    T_STRING  = 1,
-    T_OBJECT  = 2,
-    T_ARRAY   = 3,
-    T_BOOLEAN = 4,
-    T_CHAR    = 5,
-    T_FLOAT   = 6,
-    T_DOUBLE  = 7,
-    T_BYTE    = 8,
-    T_SHORT   = 9,
-    T_INT     = 10,
-    T_LONG    = 11,
-};
+#include <sstream>
+#include <bit>
 
 std::string getType(int type)
 {
@@ -36,77 +28,139 @@ std::string getType(int type)
     throw fmt::format("Invalid type: '{}'.", type);
 }
 
-attribute_info readAttribute(Buffer & buffer)
+attribute_info readAttribute(Reader & buffer)
 {
     attribute_info info;
 
     info.attribute_name_index = r16();
     auto length = r32();
     info.attribute_length = length;
-
-    for (u4 i = 0; i < length; ++i)
-    {
-        info.info.push_back(r8());
-    }
+    info.info = buffer.view(length);
 
     return info;
 }
 
-std::string getTypeFromDescriptor(std::string descriptor, u8 flags)
+std::string_view getTypeFromDescriptor(std::string_view descriptorView, u8 flags)
 {
-    int count = 0;
-    while (descriptor.size() && descriptor.front() == '[')
-    {
-        descriptor.erase(descriptor.begin());
-        ++count;
-    }
+    static Memo<std::string> memo;
+    thread_local std::string key;
+    key.assign(1, static_cast<char>(flags));
+    key += descriptorView;
 
-    std::string prefix;
-    std::string suffix;
-    if (flags & CONST_TYPE)    prefix += "const ";
-    if (flags & UNSIGNED_TYPE) prefix += "u";
-    if (flags & POINTER_TYPE)  suffix += "*";
+    return memo.get(key, [&]() -> std::string {
+        std::string descriptor { descriptorView };
+        int count = 0;
+        while (descriptor.size() && descriptor.front() == '[')
+        {
+            descriptor.erase(descriptor.begin());
+            ++count;
+        }
 
-    if (descriptor == "I")
-    {
-        return prefix + "int32_t" + suffix;
-    }
+        std::string prefix;
+        std::string suffix;
+        if (flags & CONST_TYPE)    prefix += "const ";
+        if (flags & UNSIGNED_TYPE) prefix += "u";
+        if (flags & POINTER_TYPE)  suffix += "*";
 
-    if (descriptor == "B")
-    {
-        return prefix + "int8_t" + suffix;
-    }
+        if (descriptor == "I")
+        {
+            return prefix + "int32_t" + suffix;
+        }
 
-    if (descriptor == "S")
-    {
-        return prefix + "int16_t" + suffix;
-    }
+        if (descriptor == "B")
+        {
+            return prefix + "int8_t" + suffix;
+        }
 
-    if (descriptor == "Z")
-    {
-        return prefix + "bool" + suffix;
-    }
+        if (descriptor == "S")
+        {
+            return prefix + "int16_t" + suffix;
+        }
 
-    if (descriptor == "F")
-    {
-        return prefix + "float" + suffix;
-    }
+        if (descriptor == "Z")
+        {
+            return prefix + "bool" + suffix;
+        }
 
-    if (descriptor.starts_with("L") && descriptor.ends_with(";"))
-    {
-        auto jt = descriptor.substr(1, descriptor.size() - 2);
-        if (jt.starts_with("types/"))
+        if (descriptor == "F")
         {
-            return jt.substr(6) + "_t";
+            return prefix + "float" + suffix;
         }
-        return prefix + javaToCpp(jt) + suffix;
-    }
 
-    throw fmt::format("Invalid type used as a static field: '{}'.", descriptor);
+        if (descriptor.starts_with("L") && descriptor.ends_with(";"))
+        {
+            auto jt = descriptor.substr(1, descriptor.size() - 2);
+            if (jt.starts_with("types/"))
+            {
+                return jt.substr(6) + "_t";
+            }
+            return prefix + javaToCpp(jt) + suffix;
+        }
+
+        throw fmt::format("Invalid type used as a static field: '{}'.", descriptor);
+    });
 }
 
 template<class> inline constexpr bool always_false_v = false;
 
+static void renderExpr(const Expr & expr, std::string & output)
+{
+    switch (expr.kind)
+    {
+    case Expr::Kind::Text:
+        output += expr.text;
+        break;
+    case Expr::Kind::Binary:
+        output += '(';
+        renderExpr(*expr.left, output);
+        output += ' ';
+        output += expr.text;
+        output += ' ';
+        renderExpr(*expr.right, output);
+        output += ')';
+        break;
+    case Expr::Kind::Prefix:
+        output += expr.text;
+        renderExpr(*expr.left, output);
+        break;
+    case Expr::Kind::Cast:
+        output += "static_cast<";
+        output += expr.text;
+        output += ">(";
+        renderExpr(*expr.left, output);
+        output += ')';
+        break;
+    case Expr::Kind::Index:
+        renderExpr(*expr.left, output);
+        output += '[';
+        renderExpr(*expr.right, output);
+        output += ']';
+        break;
+    case Expr::Kind::Member:
+    case Expr::Kind::Call:
+        if (expr.left)
+        {
+            renderExpr(*expr.left, output);
+            output += '.';
+        }
+        output += expr.text;
+        if (expr.kind == Expr::Kind::Call)
+        {
+            output += '(';
+            for (size_t i = 0; i < expr.args.size(); ++i)
+            {
+                if (i > 0)
+                {
+                    output += ", ";
+                }
+                renderExpr(*expr.args[i], output);
+            }
+            output += ')';
+        }
+        break;
+    }
+}
+
 std::string getAsString(const Value & value)
 {
     return std::visit([](auto&& arg) {
@@ -120,17 +174,26 @@ std::string getAsString(const Value & value)
         {
             return fmt::format("{}L", arg);
         }
-        else if constexpr (std::is_same_v<T, float>)
+        else if constexpr (std::is_same_v<T, float> || std::is_same_v<T, double>)
         {
-            return fmt::format("{}", arg);
-        }
-        else if constexpr (std::is_same_v<T, double>)
-        {
-            return fmt::format("{}", arg);
+            // always a floating literal, so "1 / 2.0f" isn't turned into an integer division,
+            // and "f" keeps float arithmetic in single precision
+            auto output = fmt::format("{}", arg);
+            if (std::isfinite(arg) && output.find_first_of(".e") == std::string::npos)
+            {
+                output += ".0";
+            }
+            if (std::is_same_v<T, float> && std::isfinite(arg))
+            {
+                output += 'f';
+            }
+            return output;
         }
-        else if constexpr (std::is_same_v<T, std::string>)
+        else if constexpr (std::is_same_v<T, const Expr *>)
         {
-            return arg;
+            std::string output;
+            renderExpr(*arg, output);
+            return output;
         }
         else if constexpr (std::is_same_v<T, Array>)
         {
@@ -169,34 +232,31 @@ std::string invertBinaryOperator(std::string binop)
     throw fmt::format("'{}' is not a valid binary operator.", binop);
 }
 
-ClassFile::ClassFile(std::string filename, std::string projectName, bool partial)
+std::string ClassFile::classPath(std::string filename)
 {
-    project_name = projectName;
-
-    filePath = filename.substr(0, filename.rfind('.'));
-    if (filePath.starts_with("./"))
+    auto path = filename.substr(0, filename.rfind('.'));
+    if (path.starts_with("./"))
     {
-        filePath = filePath.substr(2);
+        path = path.substr(2);
     }
+    return path;
+}
+
+ClassFile::ClassFile(std::string filename)
+{
+    filePath = classPath(filename);
     fileName = filePath;
     if (fileName.contains("/"))
     {
         fileName = fileName.substr(fileName.rfind('/') + 1);
     }
-    std::ifstream file(filePath + ".class", std::ios::binary);
-    assert(file.is_open());
-
-    file.seekg(0, std::ios::end);
-    auto fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    if (fileSize == 0)
+    auto contents = loadFile(filePath + ".class");
+    if (contents.empty())
     {
         throw fmt::format("File is empty.");
     }
 
-    Buffer buffer(fileSize);
-    file.read((char*) &buffer[0], fileSize);
+    Reader buffer(contents);
 
     auto magic = r32();
     if (magic != 0xCAFEBABE)
@@ -217,13 +277,10 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
         case CONSTANT_Utf8:
         {
             auto length = r16();
+            auto bytes = buffer.view(length);
             Utf8 info;
             info.length = length;
-
-            for (int i = 0; i < length; ++i)
-            {
-                info.bytes.push_back(r8());
-            }
+            info.bytes = { reinterpret_cast<const char*>(bytes.data()), bytes.size() };
 
             constantPool.push_back(info);
             break;
@@ -341,6 +398,7 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
         auto attributes_count = r16();
 
         u8 flags = 0;
+        u2 constantValue = 0;
 
         if (access_flags & ACC_FINAL)
         {
@@ -353,7 +411,7 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
             auto attribute_name = getStringFromUtf8(attr.attribute_name_index);
             if (attribute_name == "RuntimeInvisibleAnnotations")
             {
-                auto buffer = attr.info;
+                Reader buffer(attr.info);
 
                 auto num_annotations = r16();
                 for (u2 ii = 0; ii < num_annotations; ++ii)
@@ -372,29 +430,40 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
                     }
                 }
             }
+            else if (attribute_name == "ConstantValue")
+            {
+                Reader buffer(attr.info);
+                constantValue = r16();
+            }
         }
 
-        auto name = getStringFromUtf8(name_index);
-        auto descriptor = getStringFromUtf8(descriptor_index);
+        auto name = intern(getStringFromUtf8(name_index));
+        auto descriptor = intern(getStringFromUtf8(descriptor_index));
 
+        fieldIndex[name] = fields.size();
         fields.push_back({ name, getTypeFromDescriptor(descriptor, flags), descriptor[0] == '[', access_flags });
-    }
 
-    struct MethData
-    {
-        std::string name;
-        std::string descriptor;
-        u1 returnFlags; // return flag
-        std::vector<u1> flags; // parameters' flags
-        Buffer buffer;
-    };
-
-    std::vector<MethData> methodsToDecompile;
+        // static constants have no <clinit> code
+        if (constantValue && (access_flags & ACC_STATIC))
+        {
+            auto & field = fields.back();
+            field.constantValue = constantValue;
+            if (auto str = std::get_if<String>(&constantPool[constantValue]))
+            {
+                field.init = fmt::format("\"{}\"", getStringFromUtf8(str->string_index));
+            }
+            else if (auto constant = fieldConstant(name))
+            {
+                field.init = getAsString(*constant);
+            }
+        }
+    }
 
+    std::unordered_map<SymbolKey, size_t, SymbolKeyHash> methodIndex; // index in methodsToDecompile
     auto methods_count = r16();
     for (int i = 0; i < methods_count; ++i)
     {
-        [[maybe_unused]] auto access_flags = r16();
+        auto access_flags = r16();
         auto name_index = r16();
         auto descriptor_index = r16();
         auto attributes_count = r16();
@@ -405,39 +474,36 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
             attributes.push_back(readAttribute(buffer));
         }
 
-        auto name = getStringFromUtf8(name_index);
-        auto descriptor = getStringFromUtf8(descriptor_index);
+        auto name = intern(getStringFromUtf8(name_index));
+        auto descriptor = intern(getStringFromUtf8(descriptor_index));
         auto flags = std::vector<u1>(countArgs(descriptor), u1{});
 
+        // the entry of this method, created by the first attribute needing it
+        auto methodData = [&]() -> MethData & {
+            auto [it, inserted] = methodIndex.try_emplace({ name, descriptor }, methodsToDecompile.size());
+            if (inserted)
+            {
+                methodsToDecompile.push_back({ name, descriptor, 0, flags, {}, access_flags });
+            }
+            return methodsToDecompile[it->second];
+        };
+
         for (auto & attr : attributes)
         {
             auto attribute_name = getStringFromUtf8(attr.attribute_name_index);
 
             if (attribute_name == "Code")
             {
-                methodsToDecompile.push_back({ name, descriptor, 0, flags, attr.info });
+                methodData().buffer = attr.info;
             }
             else if (attribute_name == "LineNumberTable")
             {
             }
             else if (attribute_name == "RuntimeInvisibleParameterAnnotations")
             {
-                MethData * methData = nullptr;
-                for (auto & m : methodsToDecompile)
-                {
-                    if (m.name == name)
-                    {
-                        methData = &m;
-                    }
-                }
+                auto methData = &methodData();
 
-                if (!methData)
-                {
-                    methodsToDecompile.push_back({ name, descriptor, 0, flags, {} });
-                    methData = &methodsToDecompile.back();
-                }
-
-                auto buffer = attr.info;
+                Reader buffer(attr.info);
 
                 auto num_parameters = r8();
                 for (u2 ii = 0; ii < num_parameters; ++ii)
@@ -471,22 +537,9 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
             }
             else if (attribute_name == "RuntimeInvisibleAnnotations")
             {
-                MethData * methData = nullptr;
-                for (auto & m : methodsToDecompile)
-                {
-                    if (m.name == name)
-                    {
-                        methData = &m;
-                    }
-                }
+                auto methData = &methodData();
 
-                if (!methData)
-                {
-                    methodsToDecompile.push_back({ name, descriptor, 0, flags, {} });
-                    methData = &methodsToDecompile.back();
-                }
-
-                auto buffer = attr.info;
+                Reader buffer(attr.info);
 
                 auto num_annotations = r16();
                 for (u2 ii = 0; ii < num_annotations; ++ii)
@@ -513,7 +566,7 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
 
         if (attributes_count == 0)
         {
-            methodsToDecompile.push_back({ name, descriptor, 0, flags, {} });
+            methodData();
         }
     }
 
@@ -526,7 +579,7 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
         auto attribute_name = getStringFromUtf8(attributes.back().attribute_name_index);
         if (attribute_name == "RuntimeInvisibleAnnotations")
         {
-            auto buffer = attributes.back().info;
+            Reader buffer(attributes.back().info);
 
             auto num_annotations = r16();
             for (u2 ii = 0; ii < num_annotations; ++ii)
@@ -558,6 +611,22 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
                             throw fmt::format("Annotation '@Board' must contains a board.Type value.");
                         }
                     }
+                    else if (type_name == "Lboard/Profile;" && element_name == "value")
+                    {
+                        auto type_name_index = r16();
+                        auto type_name = getStringFromUtf8(type_name_index);
+                        auto const_name_index = r16();
+                        auto const_name = getStringFromUtf8(const_name_index);
+
+                        if (type_name == "Lboard/Optimize;")
+                        {
+                            profile_name = const_name;
+                        }
+                        else
+                        {
+                            throw fmt::format("Annotation '@Profile' must contains a board.Optimize value.");
+                        }
+                    }
                     else if (type_name == "Lgamebuino/Config;")
                     {
                         auto const_value_index = r16();
@@ -638,7 +707,7 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
         }
         else if (attribute_name == "BootstrapMethods")
         {
-            auto buffer = attributes.back().info;
+            Reader buffer(attributes.back().info);
 
             u2 num_bootstrap_methods = r16();
 
@@ -647,8 +716,8 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
                 u2 bootstrap_method_ref = r16();
                 auto bootstrap_method_handle = std::get<MethodHandle>(constantPool[bootstrap_method_ref]);
                 auto bootstrap_method = std::get<Methodref>(constantPool[bootstrap_method_handle.reference_index]);
-                auto bootstrap_className = getStringFromUtf8(std::get<Class>(constantPool[bootstrap_method.class_index]).name_index);
-                auto bootstrap_descriptor = getStringFromUtf8(std::get<NameAndType>(constantPool[bootstrap_method.name_and_type_index]).descriptor_index);
+                [[maybe_unused]] auto bootstrap_className = getStringFromUtf8(std::get<Class>(constantPool[bootstrap_method.class_index]).name_index);
+                [[maybe_unused]] auto bootstrap_descriptor = getStringFromUtf8(std::get<NameAndType>(constantPool[bootstrap_method.name_and_type_index]).descriptor_index);
                 auto bootstrap_methodName = getStringFromUtf8(std::get<NameAndType>(constantPool[bootstrap_method.name_and_type_index]).name_index);
 
                 std::vector<std::string> args;
@@ -667,7 +736,7 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
 
                         auto method = std::get<Methodref>(constantPool[handle.reference_index]);
                         auto className = getStringFromUtf8(std::get<Class>(constantPool[method.class_index]).name_index);
-                        auto descriptor = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).descriptor_index);
+                        [[maybe_unused]] auto descriptor = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).descriptor_index);
                         auto methodName = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).name_index);
 
                         auto fullName = fmt::format("{}::{}", className, methodName);
@@ -687,7 +756,7 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
                     {
                         auto data = std::get<String>(bootstrap_pool);
                         auto str = getStringFromUtf8(data.string_index);
-                        args.push_back(str);
+                        args.emplace_back(str);
                     }
                     else if (std::holds_alternative<MethodType>(bootstrap_pool))
                     {
@@ -732,26 +801,46 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
         auto skip = hasBoard() && name == CONSTRUCTOR;
         if (!skip)
         {
-            FunctionData funData;
+            FunctionData funData {};
             funData.name = name;
             funData.descriptor = meth.descriptor;
             funData.returnFlags = meth.returnFlags;
             funData.parametersFlags = meth.flags;
 
+            functionIndex[{ funData.name, funData.descriptor }] = functions.size();
             functions.push_back(funData);
         }
     }
 
-    if (partial)
+}
+
+void ClassFile::decompile(const Project & owner)
+{
+    if (project)
     {
         return;
     }
 
+    project = &owner;
+    project_name = owner.name;
+    resolveReferences();
+
+    struct Job
+    {
+        std::string name;
+        std::span<const u1> code;
+        std::vector<std::tuple<u2, u2>> lineNumbers;
+        FunctionData * target; // nullptr for <clinit>
+    };
+
+    std::vector<attribute_info> attributes;
+    std::vector<Job> jobs;
+
     for (auto & meth : methodsToDecompile)
     {
         auto name = meth.name;
         auto descriptor = meth.descriptor;
-        auto buffer = meth.buffer;
+        Reader buffer(meth.buffer);
 
         if (!buffer.size())
         {
@@ -763,11 +852,7 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
         [[maybe_unused]] u2 max_locals = r16();
         u4 code_length = r32();
 
-        Buffer code;
-        for (u4 i = 0; i < code_length; ++i)
-        {
-            code.push_back(r8());
-        }
+        auto code = buffer.view(code_length);
 
         u2 exception_table_length = r16();
         for (u4 i = 0; i < exception_table_length; ++i)
@@ -787,7 +872,7 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
             auto attribute_name = getStringFromUtf8(attributes.back().attribute_name_index);
             if (attribute_name == "LineNumberTable")
             {
-                auto buffer = attributes.back().info;
+                Reader buffer(attributes.back().info);
                 u2 line_number_table_length = r16();
                 for (u2 a = 0; a < line_number_table_length; ++a)
                 {
@@ -808,24 +893,145 @@ ClassFile::ClassFile(std::string filename, std::string projectName, bool partial
 
         if (name == STATIC_INIT)
         {
-            lineAnalyser(code, STATIC_INIT, lineNumbers);
+            jobs.push_back({ STATIC_INIT, code, lineNumbers, nullptr });
         }
         else
         {
             auto skip = hasBoard() && name == CONSTRUCTOR;
             if (!skip)
             {
-                for (auto & funData : functions)
+                auto it = functionIndex.find({ name, descriptor });
+                if (it != functionIndex.end() && functions[it->second].reachable)
                 {
-                    if (funData.name == name)
-                    {
-                        funData.instructions = lineAnalyser(code, name, lineNumbers);
-                        break;
-                    }
+                    jobs.push_back({ std::string(name), code, lineNumbers, &functions[it->second] });
                 }
             }
         }
     }
+
+    // methods are independent from each other, the results are gathered
+    // afterwards in the declaration order so the output stays the same.
+    std::vector<std::vector<Instruction>> results(jobs.size());
+    std::vector<std::vector<Resource>> usedResources(jobs.size());
+    parallel_for(jobs.size(), [&](size_t i) {
+        MethodDecompiler decompiler(*this);
+        results[i] = decompiler.lineAnalyser(jobs[i].code, jobs[i].name, jobs[i].lineNumbers);
+        usedResources[i] = std::move(decompiler.resources);
+    });
+
+    std::vector<Resource> staticResources;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        if (jobs[i].target)
+        {
+            jobs[i].target->instructions = std::move(results[i]);
+        }
+
+        auto & used = jobs[i].target ? resources : staticResources;
+        used.insert(used.end(), usedResources[i].begin(), usedResources[i].end());
+    }
+
+    // the fields <clinit> computes get their final value instead of what was decompiled
+    for (auto & job : jobs)
+    {
+        if (job.name != STATIC_INIT)
+        {
+            continue;
+        }
+
+        for (auto & [name, init, constant] : evaluateStaticInit(*this, job.code))
+        {
+            auto it = fieldIndex.find(name);
+            if (it != fieldIndex.end())
+            {
+                fields[it->second].init = init;
+                fields[it->second].constantInit = constant;
+            }
+        }
+    }
+
+    // <clinit> only brings the images of the fields still emitted
+    for (auto & res : staticResources)
+    {
+        auto name = encode_filename(res.filename);
+        auto used = std::ranges::any_of(fields, [&](auto & field) {
+            return field.reachable && field.init && field.init->contains(name);
+        });
+        if (used)
+        {
+            resources.push_back(res);
+        }
+    }
+}
+
+void ClassFile::resolveReferences()
+{
+    resolvedPool.assign(constantPool.size(), {});
+
+    for (size_t i = 0; i < constantPool.size(); ++i)
+    {
+        u2 classIndex, natIndex;
+        if (auto field = std::get_if<Fieldref>(&constantPool[i]))
+        {
+            classIndex = field->class_index;
+            natIndex = field->name_and_type_index;
+        }
+        else if (auto method = std::get_if<Methodref>(&constantPool[i]))
+        {
+            classIndex = method->class_index;
+            natIndex = method->name_and_type_index;
+        }
+        else
+        {
+            continue;
+        }
+
+        auto & nat = std::get<NameAndType>(constantPool[natIndex]);
+        auto className = intern(getStringFromUtf8(std::get<Class>(constantPool[classIndex]).name_index));
+        auto name = intern(getStringFromUtf8(nat.name_index));
+        auto descriptor = intern(getStringFromUtf8(nat.descriptor_index));
+
+        std::string qualified { name };
+        if (className != project_name && className != "arduino/std")
+        {
+            qualified = fmt::format("{}::{}", className, qualified);
+        }
+        auto cppName = intern(javaToCpp(qualified));
+
+        if (std::holds_alternative<Fieldref>(constantPool[i]))
+        {
+            resolvedPool[i] = ResolvedFieldRef { className, name, descriptor, cppName };
+            continue;
+        }
+
+        ResolvedMethodRef ref;
+        ref.className = className;
+        ref.name = name;
+        ref.descriptor = descriptor;
+        ref.cppName = cppName;
+        ref.cppClassName = intern(javaToCpp(std::string(className)));
+        try
+        {
+            ref.argsCount = countArgs(descriptor);
+            ref.returnType = getReturnType(descriptor, 0);
+        }
+        catch (const std::string & str)
+        {
+            // only an error if the method is really called (e.g. String.valueOf(char) is handled apart)
+            ref.argsCount.reset();
+            ref.error = str;
+        }
+        resolvedPool[i] = std::move(ref);
+    }
+}
+
+u4 ResolvedMethodRef::args() const
+{
+    if (!argsCount)
+    {
+        throw error;
+    }
+    return *argsCount;
 }
 
 bool ClassFile::hasBoard() const
@@ -838,9 +1044,82 @@ std::string ClassFile::boardName() const
     return board_name;
 }
 
-void ClassFile::generate(const std::vector<ClassFile> & files, Board board)
+static std::string_view withoutConst(std::string_view type)
+{
+    if (type.starts_with("const "))
+    {
+        type.remove_prefix(6);
+    }
+    return type;
+}
+
+// the elements of a final array written by some method can't be const
+static std::string_view fieldType(const FieldData & field)
+{
+    return field.written ? withoutConst(field.type) : field.type;
+}
+
+// final fields computed at transpile time are constexpr, so they stay in flash
+static std::string declaredType(const FieldData & field)
+{
+    if (!field.constantInit || !(field.flags & ACC_FINAL) || field.written)
+    {
+        return std::string(fieldType(field));
+    }
+
+    return fmt::format("constexpr {}", withoutConst(field.type));
+}
+
+// static final arrays computed at transpile time and never written are
+// placed in flash and read in place, the board maps it in the address space
+static bool inFlash(const FieldData & field)
+{
+    return field.isArray && field.constantInit && !field.written
+        && (field.flags & (ACC_STATIC | ACC_FINAL)) == (ACC_STATIC | ACC_FINAL);
+}
+
+// board functions only the generated code calls get internal linkage
+static std::string_view linkage(const FunctionData & func)
+{
+    if (func.external)
+    {
+        return "";
+    }
+    return func.inlined ? "static inline " : "static ";
+}
+
+static void writeBody(std::ostream & out, const FunctionData & func)
+{
+    out << "{\n";
+
+    int depth = 0;
+    for (auto & inst : func.instructions)
+    {
+        if (inst.opcode.starts_with("}")) --depth;
+        if (inst.opcode.size())
+        {
+            out << std::string(depth + 1, '\t') << inst.opcode << '\n';
+        }
+        if (inst.opcode.starts_with("{")) ++depth;
+    }
+    out << "}\n";
+}
+
+static std::string_view flashAttribute(Board board)
+{
+    switch (board)
+    {
+    case Board::Gamebuino:
+        return "PROGMEM";
+    default: // pico-sdk, every other board is a RP2040
+        return "__in_flash()";
+    }
+}
+
+std::vector<std::string> ClassFile::generate(const std::vector<ClassFile> & files, Board board)
 {
-    std::ofstream output_h(fileName + ".h");
+    std::vector<std::string> outputs;
+    std::ostringstream output_h;
 
     output_h << "#ifndef " << boost::to_upper_copy(fileName) << "_H\n"
              << "#define " << boost::to_upper_copy(fileName) << "_H\n";
@@ -876,6 +1155,8 @@ void ClassFile::generate(const std::vector<ClassFile> & files, Board board)
 
         for (auto & field : fields)
         {
+            if (!field.reachable) continue;
+
             if (hasBoard())
             {
                 if ((field.flags & ACC_PUBLIC) == 0) continue;
@@ -883,7 +1164,8 @@ void ClassFile::generate(const std::vector<ClassFile> & files, Board board)
                 output_h << "extern ";
             }
 
-            output_h << field.type;
+            // class members aren't static, they can't be constexpr
+            output_h << fieldType(field);
             if (!field.init.has_value() && field.isArray)
             {
                 output_h << '*';
@@ -909,7 +1191,7 @@ void ClassFile::generate(const std::vector<ClassFile> & files, Board board)
 
     for (auto & func : functions)
     {
-        if (func.name == STATIC_INIT)
+        if (func.name == STATIC_INIT || !func.reachable)
         {
             continue;
         }
@@ -930,7 +1212,18 @@ void ClassFile::generate(const std::vector<ClassFile> & files, Board board)
                 }
                 output_h << getReturnType(func.descriptor, func.returnFlags) << " " << func.name;
             }
-            output_h << "(" << generateParameters(func.descriptor, func.parametersFlags, true) << ");\n";
+            output_h << "(" << generateParameters(func.descriptor, func.parametersFlags, true) << ")";
+
+            // short members are defined here, so they are implicitly inline
+            if (!hasBoard() && func.inlined)
+            {
+                output_h << '\n';
+                writeBody(output_h, func);
+            }
+            else
+            {
+                output_h << ";\n";
+            }
         }
     }
 
@@ -941,7 +1234,8 @@ void ClassFile::generate(const std::vector<ClassFile> & files, Board board)
 
     output_h << "#endif\n";
 
-    output_h.close();
+    outputs.push_back(fileName + ".h");
+    writeIfChanged(outputs.back(), output_h.str());
 
     std::string extension;
     switch (board)
@@ -954,7 +1248,7 @@ void ClassFile::generate(const std::vector<ClassFile> & files, Board board)
         break;
     }
 
-    std::ofstream output_c(fileName + "." + extension);
+    std::ostringstream output_c;
 
     if (hasBoard() || board != Board::Gamebuino)
     {
@@ -992,14 +1286,23 @@ void ClassFile::generate(const std::vector<ClassFile> & files, Board board)
 
         for (auto & field : fields)
         {
+            if (!field.reachable) continue;
+
             if ((field.flags & ACC_PUBLIC)) continue;
 
+            if (inFlash(field))
+            {
+                output_c << fmt::format("static const {} {}[] {} = {};\n", withoutConst(field.type), field.name,
+                                        flashAttribute(board), field.init.value());
+                continue;
+            }
+
             if (field.init.has_value() && field.init.value() == "null")
             {
                 output_c << "extern ";
             }
 
-            output_c << field.type;
+            output_c << declaredType(field);
             if (!field.init.has_value() && field.isArray)
             {
                 output_c << '*';
@@ -1024,19 +1327,19 @@ void ClassFile::generate(const std::vector<ClassFile> & files, Board board)
 
         for (auto & func : functions)
         {
-            if (func.name == STATIC_INIT)
+            if (func.name == STATIC_INIT || !func.reachable)
             {
                 continue;
             }
 
-            output_c << getReturnType(func.descriptor, func.returnFlags) << " " << func.name
+            output_c << linkage(func) << getReturnType(func.descriptor, func.returnFlags) << " " << func.name
                      << "(" << generateParameters(func.descriptor, func.parametersFlags, false) << ");\n";
         }
     }
 
     for (auto & func : functions)
     {
-        if (func.name == STATIC_INIT)
+        if (func.name == STATIC_INIT || !func.reachable || (!hasBoard() && func.inlined))
         {
             continue;
         }
@@ -1056,62 +1359,64 @@ void ClassFile::generate(const std::vector<ClassFile> & files, Board board)
         }
         else
         {
-            output_c << getReturnType(func.descriptor, func.returnFlags) << " " << classNameSpace << func.name;
-        }
-        output_c << "(" << generateParameters(func.descriptor, func.parametersFlags, !hasBoard()) << ")\n{\n";
-
-        int depth = 0;
-        for (auto & inst : func.instructions)
-        {
-            if (inst.opcode.starts_with("}")) --depth;
-            if (inst.opcode.size())
-            {
-                output_c << std::string(depth + 1, '\t') << inst.opcode << '\n';
-            }
-            if (inst.opcode.starts_with("{")) ++depth;
+            output_c << linkage(func) << getReturnType(func.descriptor, func.returnFlags) << " "
+                     << classNameSpace << func.name;
         }
-        output_c << "}\n";
+        output_c << "(" << generateParameters(func.descriptor, func.parametersFlags, !hasBoard()) << ")\n";
+        writeBody(output_c, func);
     }
 
-    output_c.close();
+    outputs.push_back(fileName + "." + extension);
+    writeIfChanged(outputs.back(), output_c.str());
 
     if (board == Board::Gamebuino && hasBoard() && gbConfig.size())
     {
-        std::ofstream output_config("config.h");
+        std::ostringstream output_config;
 
         for (auto & [k, v] : gbConfig)
         {
             output_config << "#define " << k << " " << v << '\n';
         }
 
-        output_config.close();
+        outputs.push_back("config.h");
+        writeIfChanged(outputs.back(), output_config.str());
     }
+
+    return outputs;
 }
 
-std::vector<Instruction> ClassFile::lineAnalyser(Buffer & buffer, const std::string & name, std::vector<std::tuple<u2, u2>> lineNumbers)
+MethodDecompiler::MethodDecompiler(ClassFile & owner)
+    : owner(owner)
+    , constantPool(owner.constantPool)
+    , resolvedPool(owner.resolvedPool)
+    , functions(owner.functions)
+    , fields(owner.fields)
+    , callbacksMethods(owner.callbacksMethods)
+    , project_name(owner.project_name)
+    , project(owner.project)
+{
+}
+
+std::vector<Instruction> MethodDecompiler::lineAnalyser(std::span<const u1> code, const std::string & name, std::vector<std::tuple<u2, u2>> lineNumbers)
 {
     insts.clear();
     localsTypes.clear();
     localsTypes.push_back({});
     closingBraces.clear();
 
-    fullBuffer = &buffer;
-    lines = &lineNumbers;
+    fullBuffer = code;
+    lines.emplace(lineNumbers);
 
-    std::unordered_map<int, Buffer> buffers;
-    std::set<int> order;
+    // a line can be split in several ranges (i.e. "for" loops), chain them
+    std::pmr::unordered_map<int, Reader> buffers { &arena };
+    std::pmr::set<int> order { &arena };
     for (size_t i = 0; i < lineNumbers.size(); ++i)
     {
         auto begin = std::get<0>(lineNumbers[i]);
-        auto end = (i + 1 < lineNumbers.size() ? std::get<0>(lineNumbers[i + 1]) : buffer.size());
-        auto sub = Buffer(&buffer[begin], &buffer[end]);
+        auto end = (i + 1 < lineNumbers.size() ? std::get<0>(lineNumbers[i + 1]) : code.size());
 
         auto line = std::get<1>(lineNumbers[i]);
-        buffers[line].insert(
-                    buffers[line].end(),
-                    std::make_move_iterator(sub.begin()),
-                    std::make_move_iterator(sub.end())
-                    );
+        buffers[line].append(code.subspan(begin, end - begin));
         order.insert(line);
     }
 
@@ -1133,13 +1438,12 @@ std::vector<Instruction> ClassFile::lineAnalyser(Buffer & buffer, const std::str
     return insts;
 }
 
-std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const std::string & name, u4 position)
+std::pmr::vector<Instruction> MethodDecompiler::decodeBytecodeLine(Reader & buffer, const std::string & name, u4 position)
 {
-    auto buffer_size = buffer.size();
     auto start_pc = getOpcodeFromLine(position);
 
-    std::vector<Operation> operations;
-    std::vector<Instruction> lineInsts = { Instruction() };
+    std::pmr::vector<Operation> operations { &arena };
+    std::pmr::vector<Instruction> lineInsts { { Instruction() }, &arena };
     Instruction & inst = lineInsts.front();
     inst.position = position;
 
@@ -1187,7 +1491,7 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             Array arr;
             arr.size = size;
             arr.type = cppType;
-            arr.position = start_pc + buffer_size - buffer.size() - 1;
+            arr.position = start_pc + buffer.tell() - 1;
             stack.push_back(arr);
             break;
         }
@@ -1212,44 +1516,42 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto & locals = localsTypes.back();
             auto localType = findLocal(index);
 
-            Operation op;
-            op.type = OpType::Store;
-            op.store.index = index;
+            StoreOp op;
+            op.index = index;
 
             if (std::holds_alternative<Array>(v))
             {
                 auto arr = std::get<Array>(v);
 
-                op.store.size = arr.size;
-                op.store.position = arr.position;
-                op.store.arr_type = arr.type;
-                op.store.populate = arr.populate;
+                op.size = arr.size;
+                op.position = arr.position;
+                op.arr_type = arr.type;
+                op.populate = arr.populate;
 
                 if (localType != T_ARRAY)
                 {
-                    op.store.type = arr.type;
+                    op.type = arr.type;
                     locals[index] = T_ARRAY;
                 }
             }
-            else if (std::holds_alternative<std::string>(v))
+            else if (std::holds_alternative<const Expr *>(v))
             {
-                auto str = std::get<std::string>(v);
-                op.store.arr_type = "std::string";
-                op.store.value = str;
+                op.arr_type = "std::string";
+                op.value = getAsString(v);
                 if (localType != T_STRING)
                 {
-                    op.store.type =  op.store.arr_type;
+                    op.type =  op.arr_type;
                     locals[index] = T_STRING;
                 }
             }
             else if (std::holds_alternative<Object>(v))
             {
                 auto obj = std::get<Object>(v);
-                op.store.arr_type = obj.type;
+                op.arr_type = obj.type;
                 if (localType != T_OBJECT)
                 {
-                    op.store.type =  op.store.arr_type;
-                    op.store.value = obj.ctor;
+                    op.type =  op.arr_type;
+                    op.value = obj.ctor;
                     locals[index] = T_OBJECT;
                 }
             }
@@ -1258,7 +1560,7 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 assert(false);
             }
 
-            operations.push_back(op);
+            operations.push_back(std::move(op));
             break;
         }
         case iconst_0:
@@ -1286,6 +1588,18 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
         case istore_1:
         case istore_2:
         case istore_3:
+        case lstore_0:
+        case lstore_1:
+        case lstore_2:
+        case lstore_3:
+        case fstore_0:
+        case fstore_1:
+        case fstore_2:
+        case fstore_3:
+        case dstore_0:
+        case dstore_1:
+        case dstore_2:
+        case dstore_3:
         {
             int unnumbered;
             int zero_numbered;
@@ -1302,16 +1616,28 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 this_type = T_INT;
                 break;
             case lstore:
+            case lstore_0:
+            case lstore_1:
+            case lstore_2:
+            case lstore_3:
                 unnumbered = lstore;
                 zero_numbered = lstore_0;
                 this_type = T_LONG;
                 break;
             case fstore:
+            case fstore_0:
+            case fstore_1:
+            case fstore_2:
+            case fstore_3:
                 unnumbered = fstore;
                 zero_numbered = fstore_0;
                 this_type = T_FLOAT;
                 break;
             case dstore:
+            case dstore_0:
+            case dstore_1:
+            case dstore_2:
+            case dstore_3:
                 unnumbered = dstore;
                 zero_numbered = dstore_0;
                 this_type = T_DOUBLE;
@@ -1331,40 +1657,55 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 index = opcode - zero_numbered;
             }
 
-            Operation op;
-            op.type = OpType::Store;
-            op.store.index = index;
+            StoreOp op;
+            op.index = index;
 
             auto & locals = localsTypes.back();
             auto localType = findLocal(index);
             if (localType != this_type)
             {
-                op.store.type = getType(this_type);
+                op.type = getType(this_type);
                 locals[index] = this_type;
             }
 
-            op.store.value = getAsString(v);
+            op.value = getAsString(v);
 
-            operations.push_back(op);
+            operations.push_back(std::move(op));
             break;
         }
         case iload:
+        case lload:
+        case fload:
+        case dload:
         case iload_0:
         case iload_1:
         case iload_2:
         case iload_3:
+        case lload_0:
+        case lload_1:
+        case lload_2:
+        case lload_3:
+        case fload_0:
+        case fload_1:
+        case fload_2:
+        case fload_3:
+        case dload_0:
+        case dload_1:
+        case dload_2:
+        case dload_3:
         {
             int index;
-            if (opcode == iload)
+            if (opcode <= dload)
             {
                 index = r8();
             }
             else
             {
-                index = opcode - iload_0;
+                // iload_0 to dload_3 are four by four
+                index = (opcode - iload_0) % 4;
             }
 
-            stack.push_back(fmt::format("local_{}", index));
+            stack.push_back(makeText(fmt::format("local_{}", index)));
             break;
         }
         case aload:
@@ -1383,14 +1724,14 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 index = opcode - aload_0;
             }
 
-            stack.push_back(fmt::format("local_{}", index));
+            stack.push_back(makeText(fmt::format("local_{}", index)));
             break;
         }
         case arraylength:
         {
             auto val = stack.back();
             stack.pop_back();
-            stack.push_back(fmt::format("{}.size()", std::get<std::string>(val)));
+            stack.push_back(makeExpr({ .kind = Expr::Kind::Call, .text = "size", .left = toExpr(val) }));
             break;
         }
         case if_icmpeq:
@@ -1402,7 +1743,7 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
         case if_acmpeq:
         case if_acmpne:
         {
-            auto correction = buffer_size - buffer.size() - 1;
+            auto correction = buffer.tell() - 1;
             auto offset = s16();
             auto absolute = start_pc + correction + offset;
 
@@ -1425,16 +1766,15 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             default: assert(false);
             }
 
-            Operation op;
-            op.type = OpType::Cond;
-            op.cond.op = binop;
-            op.cond.left = getAsString(left);
-            op.cond.right = getAsString(right);
-            op.cond.absolute = absolute;
+            CondOp op;
+            op.op = binop;
+            op.left = getAsString(left);
+            op.right = getAsString(right);
+            op.absolute = absolute;
 
-            operations.push_back(op);
+            operations.push_back(std::move(op));
 
-            if ((*fullBuffer)[absolute - 3] == goto_)
+            if (fullBuffer[absolute - 3] == goto_)
             {
                 // why?
                 //skippedGotos.insert(absolute - 3);
@@ -1443,16 +1783,15 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
         }
         case iinc:
         {
-            Operation op;
-            op.type = OpType::Inc;
-            op.inc.index = r8();
-            op.inc.constant = r8();
-            operations.push_back(op);
+            IncOp op;
+            op.index = r8();
+            op.constant = r8();
+            operations.push_back(std::move(op));
             break;
         }
         case goto_:
         {
-            auto correction = buffer_size - buffer.size() - 1;
+            auto correction = buffer.tell() - 1;
             auto offset = s16();
             auto absolute = start_pc + correction + offset;
 
@@ -1461,10 +1800,9 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 break;
             }
 
-            Operation op;
-            op.type = OpType::Jump;
-            op.jump.absolute = absolute;
-            operations.push_back(op);
+            JumpOp op;
+            op.absolute = absolute;
+            operations.push_back(std::move(op));
             break;
         }
         case invokedynamic:
@@ -1512,7 +1850,7 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 }
                 tpl = newTpl;
             }
-            stack.push_back(tpl);
+            stack.push_back(makeText(tpl));
             break;
         }
         case iastore:
@@ -1521,6 +1859,8 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
         case lastore:
         case dastore:
         case bastore:
+        case castore:
+        case sastore:
         {
             auto value = stack.back();
             stack.pop_back();
@@ -1529,14 +1869,13 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto arr = stack.back();
             stack.pop_back();
 
-            if (std::holds_alternative<std::string>(arr))
+            if (std::holds_alternative<const Expr *>(arr))
             {
-                Operation op;
-                op.type = OpType::IndexedStore;
-                op.istore.index = getAsString(index);
-                op.istore.array = getAsString(arr);
-                op.istore.value = getAsString(value);
-                operations.push_back(op);
+                IndexedStoreOp op;
+                op.index = getAsString(index);
+                op.array = getAsString(arr);
+                op.value = getAsString(value);
+                operations.push_back(std::move(op));
             }
             else if (std::holds_alternative<Array>(arr))
             {
@@ -1553,13 +1892,12 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
         }
         case return_:
         {
-            Operation op;
-            op.type = OpType::Return;
+            ReturnOp op;
             if (name == "main")
             {
-                op.ret.value = "0";
+                op.value = "0";
             }
-            operations.push_back(op);
+            operations.push_back(std::move(op));
             break;
         }
         case ireturn:
@@ -1571,10 +1909,9 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto val = stack.back();
             stack.pop_back();
 
-            Operation op;
-            op.type = OpType::Return;
-            op.ret.value = getAsString(val);
-            operations.push_back(op);
+            ReturnOp op;
+            op.value = getAsString(val);
+            operations.push_back(std::move(op));
             break;
         }
         case imul:
@@ -1587,7 +1924,7 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto left = stack.back();
             stack.pop_back();
 
-            stack.push_back(fmt::format("({} * {})", getAsString(left), getAsString(right)));
+            stack.push_back(arithmetic(opcode, left, right));
             break;
         }
         case iadd:
@@ -1600,15 +1937,15 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto left = stack.back();
             stack.pop_back();
 
-            stack.push_back(fmt::format("({} + {})", getAsString(left), getAsString(right)));
+            stack.push_back(arithmetic(opcode, left, right));
             break;
         }
         case invokestatic:
         {
             auto id = r16();
-            auto method = std::get<Methodref>(constantPool[id]);
-            auto className = getStringFromUtf8(std::get<Class>(constantPool[method.class_index]).name_index);
-            auto methodName = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).name_index);
+            auto & method = std::get<ResolvedMethodRef>(resolvedPool[id]);
+            auto className = method.className;
+            auto methodName = method.name;
 
             if (className == "java/lang/Integer")
             {
@@ -1628,7 +1965,9 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 {
                     auto val = stack.back();
                     stack.pop_back();
-                    stack.push_back(fmt::format("std::to_string({})", getAsString(val)));
+                    auto args = makeArgs(1);
+                    args[0] = toExpr(val);
+                    stack.push_back(makeExpr({ .kind = Expr::Kind::Call, .text = "std::to_string", .args = args }));
                     break;
                 }
                 else
@@ -1637,57 +1976,40 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 }
             }
 
-            auto descriptor = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).descriptor_index);
-            auto fullName = methodName;
-            if (className != project_name && className != "arduino/std")
-            {
-                fullName = fmt::format("{}::{}", className, fullName);
-            }
-            fullName = javaToCpp(fullName);
+            auto & fullName = method.cppName;
 
-
-            std::string argsString;
-            auto argsCount = countArgs(descriptor);
+            std::span<const Expr *> args;
+            auto argsCount = method.args();
             std::vector<u1> pFlags(argsCount, u1{});
 
             if (!fullName.contains("::"))
             {
-                for (auto & m : functions)
+                if (auto f = owner.findFunction(methodName, method.descriptor))
                 {
-                    if (fullName == m.name)
-                    {
-                        pFlags = m.parametersFlags;
-                        break;
-                    }
+                    pFlags = f->parametersFlags;
                 }
             }
             else
             {
-                for (auto & c : partialClasses)
+                if (auto c = project->findClass(className))
                 {
-                    if (c.filePath == className)
-                    {
-                        pFlags = c.getFunctionFlags(methodName);
-                        break;
-                    }
+                    pFlags = c->getFunctionFlags(methodName, method.descriptor);
                 }
             }
 
             if (argsCount && argsCount <= stack.size())
             {
                 auto offset = stack.size() - argsCount;
+                args = makeArgs(argsCount);
                 for (size_t idx = 0; idx < argsCount; ++idx)
                 {
-                    std::string ref = "";
+                    args[idx] = toExpr(stack[offset + idx]);
                     if (pFlags[idx] & POINTER_TYPE)
                     {
-                        ref = "&";
+                        args[idx] = makeExpr({ .kind = Expr::Kind::Prefix, .text = "&", .left = args[idx] });
                     }
-                    argsString += fmt::format(", {}{}", ref, getAsString(stack[offset + idx]));
                 }
 
-                argsString = argsString.substr(2);
-
                 auto tmpArgsCount = argsCount;
                 while (tmpArgsCount > 0)
                 {
@@ -1696,38 +2018,35 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 }
             }
 
-            auto callString = fmt::format("{}({})", fullName, argsString);
-            auto retType = getReturnType(descriptor, 0);
+            auto call = makeExpr({ .kind = Expr::Kind::Call, .text = fullName, .args = args });
+            auto & retType = method.returnType;
             if (retType.size() && retType != "void")
             {
-                stack.push_back(callString);
+                stack.push_back(call);
                 nonVoidReturnedValue = true;
             }
             else
             {
-                Operation op;
-                op.type = OpType::Call;
-                op.call.code = callString + ';';
-                operations.push_back(op);
+                CallOp op;
+                op.code = getAsString(call) + ';';
+                operations.push_back(std::move(op));
             }
             break;
         }
         case getstatic:
         {
             auto id = r16();
-            auto method = std::get<Fieldref>(constantPool[id]);
-            auto className = getStringFromUtf8(std::get<Class>(constantPool[method.class_index]).name_index);
-            auto descriptor = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).descriptor_index);
-            auto variableName = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).name_index);
+            auto & field = std::get<ResolvedFieldRef>(resolvedPool[id]);
 
-            auto fullName = variableName;
-            if (className != project_name && className != "arduino/std")
+            auto c = project->findClass(field.className);
+            if (auto constant = c ? c->fieldConstant(field.name) : std::nullopt)
             {
-                fullName = fmt::format("{}::{}", className, fullName);
+                stack.push_back(*constant);
+            }
+            else
+            {
+                stack.push_back(makeExpr({ .kind = Expr::Kind::Text, .text = field.cppName }));
             }
-            fullName = javaToCpp(fullName);
-
-            stack.push_back(fullName);
             break;
         }
         case sipush:
@@ -1743,50 +2062,40 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto left = stack.back();
             stack.pop_back();
 
-            stack.push_back(fmt::format("({} % {})", getAsString(left), getAsString(right)));
+            stack.push_back(arithmetic(opcode, left, right));
             break;
         }
         case putstatic:
         {
             auto id = r16();
-            auto method = std::get<Fieldref>(constantPool[id]);
-            auto className = getStringFromUtf8(std::get<Class>(constantPool[method.class_index]).name_index);
-            auto variableName = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).name_index);
-            auto descriptor = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).descriptor_index);
-
-            auto fullName = variableName;
-            if (className != project_name)
-            {
-                fullName = fmt::format("{}::{}", className, fullName);
-            }
-            fullName = javaToCpp(fullName);
+            auto & field = std::get<ResolvedFieldRef>(resolvedPool[id]);
+            auto variableName = field.name;
+            auto & fullName = field.cppName;
 
             auto val = stack.back();
             stack.pop_back();
 
             if (name == STATIC_INIT)
             {
-                for (auto & f : fields)
+                auto it = owner.fieldIndex.find(variableName);
+                if (it != owner.fieldIndex.end())
                 {
-                    if (f.name == variableName)
+                    auto & f = fields[it->second];
+                    if (std::holds_alternative<Object>(val))
                     {
-                        if (std::holds_alternative<Object>(val))
-                        {
-                            f.init = std::get<Object>(val).ctor;
-                        }
-                        else
-                        {
-                            f.init = getAsString(val);
-                        }
+                        f.init = std::get<Object>(val).ctor;
+                    }
+                    else
+                    {
+                        f.init = getAsString(val);
                     }
                 }
             }
             else
             {
-                Operation op;
-                op.type = OpType::Call;
-                op.call.code = fmt::format("{} = {};", fullName, getAsString(val));
-                operations.push_back(op);
+                CallOp op;
+                op.code = fmt::format("{} = {};", fullName, getAsString(val));
+                operations.push_back(std::move(op));
             }
             break;
         }
@@ -1800,7 +2109,7 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             Array arr;
             arr.size = size;
             arr.type = getType(type);
-            arr.position = start_pc + buffer_size - buffer.size() - 1;
+            arr.position = start_pc + buffer.tell() - 1;
             stack.push_back(arr);
             break;
         }
@@ -1825,27 +2134,23 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             {
                 auto data = std::get<String>(constant);
                 auto str = getStringFromUtf8(data.string_index);
-                stack.push_back(fmt::format("\"{}\"", str));
+                stack.push_back(makeText(fmt::format("\"{}\"", str)));
             }
             else if (std::holds_alternative<float>(constant))
             {
-                auto f = std::get<float>(constant);
-                stack.push_back(fmt::format("{}", f));
+                stack.push_back(std::get<float>(constant));
             }
             else if (std::holds_alternative<double>(constant))
             {
-                auto d = std::get<double>(constant);
-                stack.push_back(fmt::format("{}", d));
+                stack.push_back(std::get<double>(constant));
             }
             else if (std::holds_alternative<s4>(constant))
             {
-                auto s = std::get<s4>(constant);
-                stack.push_back(fmt::format("{}", s));
+                stack.push_back(std::get<s4>(constant));
             }
             else if (std::holds_alternative<s8>(constant))
             {
-                auto s = std::get<s8>(constant);
-                stack.push_back(fmt::format("{}L", s));
+                stack.push_back(std::get<s8>(constant));
             }
             else
             {
@@ -1871,32 +2176,32 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             stack.pop_back();
             auto arr = stack.back();
             stack.pop_back();
-            stack.push_back(fmt::format("{}[{}]", getAsString(arr), getAsString(index)));
+            stack.push_back(makeExpr({ .kind = Expr::Kind::Index, .left = toExpr(arr), .right = toExpr(index) }));
             break;
         }
         case l2f:
         {
             auto value = stack.back();
             stack.pop_back();
-            stack.push_back(fmt::format("static_cast<float>({})", getAsString(value)));
+            stack.push_back(convert(opcode, value));
             break;
         }
         case f2d:
         {
             auto value = stack.back();
             stack.pop_back();
-            stack.push_back(fmt::format("static_cast<double>({})", getAsString(value)));
+            stack.push_back(convert(opcode, value));
             break;
         }
         case invokespecial:
         {
             auto id = r16();
-            auto method = std::get<Methodref>(constantPool[id]);
-            auto className = getStringFromUtf8(std::get<Class>(constantPool[method.class_index]).name_index);
-            auto methodName = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).name_index);
-            auto descriptor = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).descriptor_index);
+            auto & method = std::get<ResolvedMethodRef>(resolvedPool[id]);
+            auto className = method.className;
+            auto methodName = method.name;
+            auto descriptor = method.descriptor;
 
-            auto argsCount = countArgs(descriptor);
+            auto argsCount = method.args();
 
             auto objOffset = stack.size() - argsCount - 1;
             auto objRef = getAsString(stack[objOffset]);
@@ -1929,10 +2234,22 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 {
                     if (argsCount > 1 && argsCount < 6)
                     {
-                        auto filename = std::get<std::string>(stack[offset + 0]);
+                        auto filename = getAsString(stack[offset + 0]);
                         boost::replace_all(filename, "\""s, ""s);
                         auto sFormat = getAsString(stack[offset + 1]);
-                        auto format = (sFormat.ends_with("Rgb565")) ? Format::Rgb565 : Format::Indexed;
+                        auto format = Format::Indexed;
+                        if (sFormat.ends_with("Rgb565"))
+                        {
+                            format = Format::Rgb565;
+                        }
+                        else if (sFormat.ends_with("Rgb565Lz"))
+                        {
+                            format = Format::Rgb565Lz;
+                        }
+                        else if (sFormat.ends_with("IndexedRle"))
+                        {
+                            format = Format::IndexedRle;
+                        }
 
                         int yframes = 1, xframes = 1, loop = 0;
 
@@ -1949,17 +2266,17 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                             break;
                         }
 
-                        add_resource(filename, format, yframes, xframes, loop);
+                        resources.emplace_back(filename, format, yframes, xframes, loop);
                         argsString = ", " + encode_filename(filename);
                     }
                     else if (descriptor == "([B)V")
                     {
-                        auto array = std::get<std::string>(stack[offset]);
+                        auto array = getAsString(stack[offset]);
                         argsString = ", " + array;
                     }
                     else if (descriptor == "([S)V")
                     {
-                        auto array = std::get<std::string>(stack[offset]);
+                        auto array = getAsString(stack[offset]);
                         argsString = ", " + array;
                     }
                     else
@@ -1994,24 +2311,23 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 stack.pop_back();
 
                 Object obj;
-                obj.type = javaToCpp(className);
+                obj.type = method.cppClassName;
                 obj.ctor = callString;
                 stack.push_back(obj);
             }
             else
             {
-                auto retType = getReturnType(descriptor, 0);
+                auto & retType = method.returnType;
                 if ((retType.size() && retType != "void"))
                 {
-                    stack.push_back(callString);
+                    stack.push_back(makeText(callString));
                     nonVoidReturnedValue = true;
                 }
                 else
                 {
-                    Operation op;
-                    op.type = OpType::Call;
-                    op.call.code = callString + ';';
-                    operations.push_back(op);
+                    CallOp op;
+                    op.code = callString + ';';
+                    operations.push_back(std::move(op));
                 }
             }
             break;
@@ -2019,47 +2335,44 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
         case invokevirtual:
         {
             auto id = r16();
-            auto method = std::get<Methodref>(constantPool[id]);
-            auto className = getStringFromUtf8(std::get<Class>(constantPool[method.class_index]).name_index);
-            auto methodName = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).name_index);
-            auto descriptor = getStringFromUtf8(std::get<NameAndType>(constantPool[method.name_and_type_index]).descriptor_index);
+            auto & method = std::get<ResolvedMethodRef>(resolvedPool[id]);
+            auto methodName = method.name;
 
-            auto argsCount = countArgs(descriptor);
+            auto argsCount = method.args();
 
             auto objOffset = stack.size() - argsCount - 1;
             auto objRef = getAsString(stack[objOffset]);
 
-            auto fullName = methodName;
-            std::string ths = getAsString(objRef);
-            if (hasBoard() || ths != OBJ_INSTANCE)
+            std::string fullName { methodName };
+            if (hasBoard() || objRef != OBJ_INSTANCE)
             {
                 fullName = fmt::format("{}.{}", objRef, fullName);
             }
             fullName = javaToCpp(fullName);
 
-            std::string argsString;
+            std::span<const Expr *> args;
             if (argsCount && argsCount <= stack.size())
             {
                 auto offset = stack.size() - argsCount;
                 if (fullName == "gamebuino::gb::display.printf")
                 {
-                    argsString += fmt::format(", {}", getAsString(stack[offset]));
-                    auto arr = std::get<Array>(stack[offset + 1]);
-                    for (auto p : arr.populate)
+                    auto & arr = std::get<Array>(stack[offset + 1]);
+                    args = makeArgs(1 + arr.populate.size());
+                    args[0] = toExpr(stack[offset]);
+                    for (size_t p = 0; p < arr.populate.size(); ++p)
                     {
-                        argsString += fmt::format(", {}", p);
+                        args[1 + p] = makeText(arr.populate[p]);
                     }
                 }
                 else
                 {
+                    args = makeArgs(argsCount);
                     for (size_t idx = 0; idx < argsCount; ++idx)
                     {
-                        argsString += fmt::format(", {}", getAsString(stack[offset + idx]));
+                        args[idx] = toExpr(stack[offset + idx]);
                     }
                 }
 
-                argsString = argsString.substr(2);
-
                 auto tmpArgsCount = argsCount;
                 while (tmpArgsCount > 0)
                 {
@@ -2071,19 +2384,18 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             // remove "this"
             stack.pop_back();
 
-            auto callString = fmt::format("{}({})", fullName, argsString);
-            auto retType = getReturnType(descriptor, 0);
+            auto call = makeExpr({ .kind = Expr::Kind::Call, .text = keep(fullName), .args = args });
+            auto & retType = method.returnType;
             if (retType.size() && retType != "void")
             {
-                stack.push_back(callString);
+                stack.push_back(call);
                 nonVoidReturnedValue = true;
             }
             else
             {
-                Operation op;
-                op.type = OpType::Call;
-                op.call.code = callString + ';';
-                operations.push_back(op);
+                CallOp op;
+                op.code = getAsString(call) + ';';
+                operations.push_back(std::move(op));
             }
             break;
         }
@@ -2094,7 +2406,7 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
         case ifgt:
         case ifle:
         {
-            auto correction = buffer_size - buffer.size() - 1;
+            auto correction = buffer.tell() - 1;
             auto offset = s16();
             auto absolute = start_pc + correction + offset;
 
@@ -2114,16 +2426,15 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             }
 
 
-            Operation op;
-            op.type = OpType::Cond;
-            op.cond.op = binop;
-            op.cond.left = getAsString(value);
-            op.cond.right = "0";
-            op.cond.absolute = absolute;
+            CondOp op;
+            op.op = binop;
+            op.left = getAsString(value);
+            op.right = "0";
+            op.absolute = absolute;
 
-            operations.push_back(op);
+            operations.push_back(std::move(op));
 
-            if ((*fullBuffer)[absolute - 3] == goto_)
+            if (fullBuffer[absolute - 3] == goto_)
             {
                 // why??
                 //skippedGotos.insert(absolute - 3);
@@ -2145,7 +2456,7 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto left = stack.back();
             stack.pop_back();
 
-            stack.push_back(fmt::format("({} / {})", getAsString(left), getAsString(right)));
+            stack.push_back(arithmetic(opcode, left, right));
             break;
         }
         case isub:
@@ -2155,7 +2466,7 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto left = stack.back();
             stack.pop_back();
 
-            stack.push_back(fmt::format("({} - {})", getAsString(left), getAsString(right)));
+            stack.push_back(arithmetic(opcode, left, right));
             break;
         }
         case getfield:
@@ -2164,18 +2475,14 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto objRef = stack.back();
             stack.pop_back();
 
-            auto field = std::get<Fieldref>(constantPool[index]);
-            auto fieldName = getStringFromUtf8(std::get<NameAndType>(constantPool[field.name_and_type_index]).name_index);
+            auto fieldName = std::get<ResolvedFieldRef>(resolvedPool[index]).name;
 
-            std::string ths = getAsString(objRef);
-            if (!hasBoard() && ths == OBJ_INSTANCE)
-            {
-                stack.push_back(fmt::format("{}", fieldName));
-            }
-            else
+            Expr field { .kind = Expr::Kind::Member, .text = fieldName };
+            if (hasBoard() || getAsString(objRef) != OBJ_INSTANCE)
             {
-                stack.push_back(fmt::format("{}.{}", ths, fieldName));
+                field.left = toExpr(objRef);
             }
+            stack.push_back(makeExpr(field));
             break;
         }
         case putfield:
@@ -2186,30 +2493,28 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto objRef = stack.back();
             stack.pop_back();
 
-            auto field = std::get<Fieldref>(constantPool[index]);
-            auto fieldName = getStringFromUtf8(std::get<NameAndType>(constantPool[field.name_and_type_index]).name_index);
+            auto fieldName = std::get<ResolvedFieldRef>(resolvedPool[index]).name;
 
-            Operation op;
-            op.type = OpType::Call;
+            CallOp op;
 
             std::string ths = getAsString(objRef);
             if (!hasBoard() && ths == OBJ_INSTANCE)
             {
-                op.call.code = fmt::format("{} = {};", fieldName, getAsString(value));
+                op.code = fmt::format("{} = {};", fieldName, getAsString(value));
             }
             else
             {
-                op.call.code = fmt::format("{}.{} = {};", ths, fieldName, getAsString(value));
+                op.code = fmt::format("{}.{} = {};", ths, fieldName, getAsString(value));
             }
 
-            operations.push_back(op);
+            operations.push_back(std::move(op));
             break;
         }
         case ineg:
         {
             auto value = stack.back();
             stack.pop_back();
-            stack.push_back(fmt::format("-{}", getAsString(value)));
+            stack.push_back(makeExpr({ .kind = Expr::Kind::Prefix, .text = "-", .left = toExpr(value) }));
             break;
         }
         case iconst_m1:
@@ -2224,12 +2529,12 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto left = stack.back();
             stack.pop_back();
 
-            stack.push_back(fmt::format("({} & {})", getAsString(left), getAsString(right)));
+            stack.push_back(arithmetic(opcode, left, right));
             break;
         }
         case aconst_null:
         {
-            stack.push_back("null");
+            stack.push_back(makeText("null"));
             break;
         }
         case f2i:
@@ -2238,13 +2543,16 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             auto value = stack.back();
             stack.pop_back();
 
-            stack.push_back(fmt::format("static_cast<int>({})", getAsString(value)));
+            stack.push_back(convert(opcode, value));
             break;
         }
         case i2f:
         case i2d:
         {
-            // do nothing
+            // do nothing for variables, C++ converts them where needed
+            auto value = stack.back();
+            stack.pop_back();
+            stack.push_back(convert(opcode, value));
             break;
         }
         case pop:
@@ -2254,10 +2562,9 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
                 auto callString = stack.back();
                 stack.pop_back();
 
-                Operation op;
-                op.type = OpType::Call;
-                op.call.code = getAsString(callString) + ';';
-                operations.push_back(op);
+                CallOp op;
+                op.code = getAsString(callString) + ';';
+                operations.push_back(std::move(op));
             }
             else
             {
@@ -2291,11 +2598,11 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
         const auto & o1 = operations[0];
         const auto & o2 = operations[1];
 
-        if (o2.type == OpType::Jump)
+        if (auto jump = std::get_if<JumpOp>(&o2))
         {
             inst.opcode = generateCodeFromOperation(o1, start_pc, addOpeningParen);
 
-            if (o2.jump.absolute > start_pc)
+            if (jump->absolute > start_pc)
             {
                 Instruction tmp;
                 tmp.position = position;
@@ -2304,13 +2611,13 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
             }
             else
             {
-                if (o1.type == OpType::Cond)
+                if (std::holds_alternative<CondOp>(o1))
                 {
                     // do nothing
                 }
                 else
                 {
-                    auto jumpLine = getLineFromOpcode(o2.jump.absolute);
+                    auto jumpLine = getLineFromOpcode(jump->absolute);
                     bool append = true;
                     for (size_t idx = 0; idx < insts.size(); ++idx)
                     {
@@ -2346,13 +2653,13 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
 
             parsed = true;
         }
-        else if (o1.type == OpType::Cond && o2.type == OpType::Cond)
+        else if (std::holds_alternative<CondOp>(o1) && std::holds_alternative<CondOp>(o2))
         {
-            auto & c1 = operations[0].cond;
-            auto & c2 = operations[1].cond;
+            auto & c1 = std::get<CondOp>(operations[0]);
+            auto & c2 = std::get<CondOp>(operations[1]);
             auto absolute1 = c1.absolute;
             auto absolute2 = c2.absolute;
-            //auto isGoto = (*fullBuffer)[absolute1 - 3] == goto_ || (*fullBuffer)[absolute2 - 3] == goto_;
+            //auto isGoto = fullBuffer[absolute1 - 3] == goto_ || fullBuffer[absolute2 - 3] == goto_;
 
             std::string andOrOr;
             if (absolute1 == absolute2)
@@ -2380,34 +2687,34 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
     }
     case 4:
     {
-        const auto & o1 = operations[0];
-        const auto & o2 = operations[1];
-        const auto & o3 = operations[2];
-        const auto & o4 = operations[3];
+        auto o1 = std::get_if<StoreOp>(&operations[0]);
+        auto o2 = std::get_if<CondOp>(&operations[1]);
+        auto o3 = std::get_if<IncOp>(&operations[2]);
+        auto o4 = std::get_if<JumpOp>(&operations[3]);
 
         // for loop
-        if (o1.type == OpType::Store && o2.type == OpType::Cond && o3.type == OpType::Inc && o4.type == OpType::Jump)
+        if (o1 && o2 && o3 && o4)
         {
             std::string loop_var_type;
-            if (o1.store.type.has_value())
+            if (o1->type.has_value())
             {
-                loop_var_type = o1.store.type.value() + " ";
+                loop_var_type = o1->type.value() + " ";
             }
             inst.opcode = fmt::format("for ({0}local_{1} = {2}; {3} {4} {5}; local_{6}",
-                                      loop_var_type, o1.store.index, o1.store.value.value(),
-                                      o2.cond.left, o2.cond.op, o2.cond.right,
-                                      o3.inc.index);
-            if (o3.inc.constant == 1)
+                                      loop_var_type, o1->index, o1->value.value(),
+                                      o2->left, o2->op, o2->right,
+                                      o3->index);
+            if (o3->constant == 1)
             {
                 inst.opcode += "++";
             }
             else
             {
-                inst.opcode += fmt::format(" += {}", o3.inc.constant);
+                inst.opcode += fmt::format(" += {}", o3->constant);
             }
             inst.opcode += ")";
 
-            closingBrackets.insert(getLineFromOpcode(o2.cond.absolute));
+            closingBrackets.insert(getLineFromOpcode(o2->absolute));
             addOpeningParen = true;
 
             parsed = true;
@@ -2418,12 +2725,11 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
 
     if (!parsed)
     {
-        auto op = operations[0];
-        inst.opcode = generateCodeFromOperation(op, start_pc, addOpeningParen);
+        inst.opcode = generateCodeFromOperation(operations[0], start_pc, addOpeningParen);
 
         for (size_t size = 1; size < operations.size(); ++size)
         {
-            if (operations[size-1].type == OpType::Cond)
+            if (std::holds_alternative<CondOp>(operations[size-1]))
             {
                 Instruction openingBracket;
                 openingBracket.position = position;
@@ -2495,15 +2801,13 @@ std::vector<Instruction> ClassFile::decodeBytecodeLine(Buffer & buffer, const st
     return lineInsts;
 }
 
-std::string ClassFile::generateCodeFromOperation(Operation operation, u4 start_pc, bool & addOpeningParen)
+std::string MethodDecompiler::generateCodeFromOperation(const Operation & operation, u4 start_pc, bool & addOpeningParen)
 {
     std::string output;
 
-    switch (operation.type)
-    {
-    case OpType::Store:
+    if (auto store = std::get_if<StoreOp>(&operation))
     {
-        auto s = operation.store;
+        auto & s = *store;
         std::string tmp;
 
         // if not an array print the optional type
@@ -2545,16 +2849,14 @@ std::string ClassFile::generateCodeFromOperation(Operation operation, u4 start_p
         }
 
         output = tmp + ";";
-        break;
     }
-    case OpType::IndexedStore:
+    else if (auto istore = std::get_if<IndexedStoreOp>(&operation))
     {
-        output = fmt::format("{}[{}] = {};", operation.istore.array, operation.istore.index, operation.istore.value);
-        break;
+        output = fmt::format("{}[{}] = {};", istore->array, istore->index, istore->value);
     }
-    case OpType::Return:
+    else if (auto ret = std::get_if<ReturnOp>(&operation))
     {
-        auto & val = operation.ret.value;
+        auto & val = ret->value;
         if (val.has_value())
         {
             output = fmt::format("return {};", val.value());
@@ -2563,13 +2865,12 @@ std::string ClassFile::generateCodeFromOperation(Operation operation, u4 start_p
         {
             output = fmt::format("return;");
         }
-        break;
     }
-    case OpType::Cond:
+    else if (auto cond = std::get_if<CondOp>(&operation))
     {
-        auto & c = operation.cond;
+        auto & c = *cond;
         auto absolute = c.absolute;
-        auto isGoto = (*fullBuffer)[absolute - 3] == goto_;
+        auto isGoto = fullBuffer[absolute - 3] == goto_;
         addOpeningParen = true;
 
         auto l = c.left;
@@ -2578,7 +2879,7 @@ std::string ClassFile::generateCodeFromOperation(Operation operation, u4 start_p
 
         if (isGoto)
         {
-            s2 offset = (*fullBuffer)[absolute - 2] << 8 | (*fullBuffer)[absolute - 1];
+            s2 offset = fullBuffer[absolute - 2] << 8 | fullBuffer[absolute - 1];
             u4 target = absolute - 3 + offset;
 
             if (target == start_pc)
@@ -2601,36 +2902,29 @@ std::string ClassFile::generateCodeFromOperation(Operation operation, u4 start_p
             output = fmt::format("if ({} {} {})", l, binop, r);
             closingBrackets.insert(getLineFromOpcode(absolute));
         }
-        break;
     }
-    case OpType::Inc:
+    else if (auto inc = std::get_if<IncOp>(&operation))
     {
-        if (operation.inc.constant == 1)
+        if (inc->constant == 1)
         {
-            output = fmt::format("local_{}++;", operation.inc.index);
+            output = fmt::format("local_{}++;", inc->index);
         }
         else
         {
-            output = fmt::format("local_{} += {};", operation.inc.index, operation.inc.constant);
+            output = fmt::format("local_{} += {};", inc->index, inc->constant);
         }
-        break;
     }
-    case OpType::Jump:
+    else if (auto jump = std::get_if<JumpOp>(&operation))
     {
-        auto abs_line = getLineFromOpcode(operation.jump.absolute);
+        auto abs_line = getLineFromOpcode(jump->absolute);
         auto curr_line = getLineFromOpcode(start_pc);
-        if (operation.jump.absolute > start_pc)
+        if (jump->absolute > start_pc)
         {
             if (abs_line < curr_line)
             {
-                for (u4 pos = operation.jump.absolute; pos < fullBuffer->size(); ++pos)
+                if (auto next_line = lines->nextLine(jump->absolute, fullBuffer.size(), curr_line))
                 {
-                    auto next_line = getLineFromOpcode(pos);
-                    if (next_line > curr_line)
-                    {
-                        abs_line = next_line;
-                        break;
-                    }
+                    abs_line = *next_line;
                 }
             }
 
@@ -2646,55 +2940,266 @@ std::string ClassFile::generateCodeFromOperation(Operation operation, u4 start_p
         {
             throw fmt::format("jump operations backwards are not handled.");
         }
-        break;
     }
-    case OpType::Call:
+    else if (auto call = std::get_if<CallOp>(&operation))
     {
-        output = operation.call.code;
-        break;
-    }
-    default:
-        throw fmt::format("Invalid operation: '{}'.", std::to_underlying(operation.type));
+        output = call->code;
     }
 
     return output;
 }
 
-u2 ClassFile::getLineFromOpcode(u2 opcode)
+u2 MethodDecompiler::getLineFromOpcode(u2 opcode)
 {
-    u2 lastLineSaw = 0;
+    return lines->lineFromPc(opcode);
+}
 
-    for (size_t i = 0; i < lines->size() - 1; ++i)
+u2 MethodDecompiler::getOpcodeFromLine(u2 line)
+{
+    if (auto pc = lines->pcFromLine(line))
     {
-        auto pc = std::get<0>((*lines)[i]);
-        auto nb = std::get<1>((*lines)[i]);
-        if (lastLineSaw <= nb)
+        return *pc;
+    }
+
+    throw fmt::format("Invalid line given.");
+}
+
+LineIndex::LineIndex(const std::vector<std::tuple<u2, u2>> & lineNumbers)
+{
+    u2 lastLineSaw = 0;
+    u4 maxPc = 0;
+    for (size_t i = 0; i + 1 < lineNumbers.size(); ++i)
+    {
+        auto [pc, line] = lineNumbers[i];
+        if (lastLineSaw <= line)
         {
-            if (opcode <= pc)
+            // an entry can only be found if it goes past every pc before it
+            maxPc = std::max<u4>(maxPc, pc);
+            if (stepPcs.empty() || maxPc > stepPcs.back())
             {
-                return nb;
+                stepPcs.push_back(maxPc);
+                stepLines.push_back(line);
             }
-            lastLineSaw = nb;
+            lastLineSaw = line;
+        }
+    }
+    if (!lineNumbers.empty())
+    {
+        lastLine = std::get<1>(lineNumbers.back());
+    }
+
+    for (auto [pc, line] : lineNumbers)
+    {
+        firstPc.try_emplace(line, pc);
+    }
+}
+
+u2 LineIndex::lineFromPc(u4 pc) const
+{
+    auto it = std::lower_bound(stepPcs.begin(), stepPcs.end(), pc);
+    return (it != stepPcs.end()) ? stepLines[it - stepPcs.begin()] : lastLine;
+}
+
+std::optional<u2> LineIndex::pcFromLine(u2 line) const
+{
+    auto it = firstPc.find(line);
+    if (it == firstPc.end())
+    {
+        return {};
+    }
+    return it->second;
+}
+
+std::optional<u2> LineIndex::nextLine(u4 from, u4 end, u2 line) const
+{
+    // step i covers the pcs after stepPcs[i - 1] up to stepPcs[i]
+    auto first = std::lower_bound(stepPcs.begin(), stepPcs.end(), from) - stepPcs.begin();
+    for (size_t i = first; i < stepPcs.size(); ++i)
+    {
+        u4 begin = (i > 0) ? std::max(from, stepPcs[i - 1] + 1) : from;
+        if (begin >= end)
+        {
+            return {};
         }
+        if (stepLines[i] > line)
+        {
+            return stepLines[i];
+        }
+    }
+
+    u4 begin = stepPcs.empty() ? from : std::max(from, stepPcs.back() + 1);
+    if (begin < end && lastLine > line)
+    {
+        return lastLine;
     }
+    return {};
+}
+
+std::string_view MethodDecompiler::keep(std::string_view text)
+{
+    auto data = std::pmr::polymorphic_allocator<>(&arena).allocate_object<char>(text.size());
+    std::copy(text.begin(), text.end(), data);
+    return { data, text.size() };
+}
+
+const Expr * MethodDecompiler::makeExpr(const Expr & node)
+{
+    return std::pmr::polymorphic_allocator<>(&arena).new_object<Expr>(node);
+}
 
-    return std::get<1>((*lines)[lines->size() - 1]);
+const Expr * MethodDecompiler::makeText(std::string_view text)
+{
+    return makeExpr({ .kind = Expr::Kind::Text, .text = keep(text) });
 }
 
-u2 ClassFile::getOpcodeFromLine(u2 line)
+const Expr * MethodDecompiler::toExpr(const Value & value)
 {
-    for (auto & l : *lines)
+    if (auto expr = std::get_if<const Expr *>(&value))
     {
-        if (std::get<1>(l) == line)
+        return *expr;
+    }
+    return makeText(getAsString(value));
+}
+
+std::span<const Expr *> MethodDecompiler::makeArgs(size_t count)
+{
+    return { std::pmr::polymorphic_allocator<>(&arena).allocate_object<const Expr *>(count), count };
+}
+
+template<typename T>
+static std::optional<T> constantAs(const Value & value)
+{
+    return std::visit([](auto && arg) -> std::optional<T> {
+        using V = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_arithmetic_v<V>)
+        {
+            return static_cast<T>(arg);
+        }
+        else
+        {
+            return {};
+        }
+    }, value);
+}
+
+// Java's rules: integers wrap around, floating values never trap.
+// Nothing is folded when the C++ result would differ or isn't a literal.
+template<typename T>
+static std::optional<T> foldConstants(std::string_view op, T left, T right)
+{
+    if constexpr (std::is_integral_v<T>)
+    {
+        using U = std::make_unsigned_t<T>;
+        if (op == "+") return static_cast<T>(static_cast<U>(left) + static_cast<U>(right));
+        if (op == "-") return static_cast<T>(static_cast<U>(left) - static_cast<U>(right));
+        if (op == "*") return static_cast<T>(static_cast<U>(left) * static_cast<U>(right));
+        if (op == "&") return static_cast<T>(left & right);
+
+        if (right == 0 || (left == std::numeric_limits<T>::min() && right == -1))
         {
-            return std::get<0>(l);
+            return {};
         }
+        if (op == "/") return static_cast<T>(left / right);
+        if (op == "%") return static_cast<T>(left % right);
     }
+    else
+    {
+        std::optional<T> result;
+        if (op == "+") result = left + right;
+        if (op == "-") result = left - right;
+        if (op == "*") result = left * right;
+        if (op == "/") result = left / right;
+        if (op == "%") result = std::fmod(left, right);
 
-    throw fmt::format("Invalid line given.");
+        if (result && std::isfinite(*result))
+        {
+            return result;
+        }
+    }
+    return {};
+}
+
+Value MethodDecompiler::arithmetic(u1 opcode, const Value & left, const Value & right)
+{
+    switch (opcode)
+    {
+    case iadd: return arithmetic<int32_t>("+", left, right);
+    case isub: return arithmetic<int32_t>("-", left, right);
+    case imul: return arithmetic<int32_t>("*", left, right);
+    case idiv: return arithmetic<int32_t>("/", left, right);
+    case irem: return arithmetic<int32_t>("%", left, right);
+    case iand: return arithmetic<int32_t>("&", left, right);
+    case ladd: return arithmetic<int64_t>("+", left, right);
+    case lmul: return arithmetic<int64_t>("*", left, right);
+    case fadd_: return arithmetic<float>("+", left, right);
+    case fmul_: return arithmetic<float>("*", left, right);
+    case dadd: return arithmetic<double>("+", left, right);
+    case dmul: return arithmetic<double>("*", left, right);
+    }
+
+    throw fmt::format("Unhandled arithmetic opcode: '{:x}'.", opcode);
+}
+
+// Folds constant operands and drops the neutral ones. Multiplications and
+// divisions by a power of two are kept, the C++ compiler turns them into the
+// right shifts itself, and a left shift of a negative number is undefined
+// before C++20.
+template<typename T>
+Value MethodDecompiler::arithmetic(std::string_view op, const Value & left, const Value & right)
+{
+    auto l = constantAs<T>(left);
+    auto r = constantAs<T>(right);
+    if (l && r)
+    {
+        if (auto folded = foldConstants(op, *l, *r))
+        {
+            return *folded;
+        }
+    }
+
+    if constexpr (std::is_integral_v<T>)
+    {
+        if (r && ((*r == 0 && (op == "+" || op == "-")) || (*r == 1 && (op == "*" || op == "/"))))
+        {
+            return left;
+        }
+        if (l && ((*l == 0 && op == "+") || (*l == 1 && op == "*")))
+        {
+            return right;
+        }
+    }
+
+    return makeExpr({ .kind = Expr::Kind::Binary, .text = op, .left = toExpr(left), .right = toExpr(right) });
+}
+
+Value MethodDecompiler::convert(u1 opcode, const Value & value)
+{
+    switch (opcode)
+    {
+    case i2f:
+        if (auto c = constantAs<int32_t>(value)) return static_cast<float>(*c);
+        return value;
+    case i2d:
+        if (auto c = constantAs<int32_t>(value)) return static_cast<double>(*c);
+        return value;
+    case l2f:
+        if (auto c = constantAs<int64_t>(value)) return static_cast<float>(*c);
+        return makeExpr({ .kind = Expr::Kind::Cast, .text = "float", .left = toExpr(value) });
+    case f2d:
+        if (auto c = constantAs<float>(value)) return static_cast<double>(*c);
+        return makeExpr({ .kind = Expr::Kind::Cast, .text = "double", .left = toExpr(value) });
+    case f2i:
+        if (auto c = constantAs<float>(value)) return javaToInt(*c);
+        return makeExpr({ .kind = Expr::Kind::Cast, .text = "int", .left = toExpr(value) });
+    case d2i:
+        if (auto c = constantAs<double>(value)) return javaToInt(*c);
+        return makeExpr({ .kind = Expr::Kind::Cast, .text = "int", .left = toExpr(value) });
+    }
+
+    throw fmt::format("Unhandled conversion opcode: '{:x}'.", opcode);
 }
 
-int ClassFile::findLocal(int index)
+int MethodDecompiler::findLocal(int index)
 {
     for (auto it = localsTypes.rbegin(); it != localsTypes.rend(); ++it)
     {
@@ -2708,21 +3213,82 @@ int ClassFile::findLocal(int index)
 
 }
 
-std::string ClassFile::getStringFromUtf8(int index)
+std::string_view ClassFile::getStringFromUtf8(int index) const
 {
-    auto b = std::get<Utf8>(constantPool[index]).bytes;
-    return std::string { begin(b), end(b) };
+    return std::get<Utf8>(constantPool[index]).bytes;
 }
 
-std::vector<u1> ClassFile::getFunctionFlags(std::string name)
+std::span<const u1> ClassFile::loadFile(const std::string & path)
 {
-    for (auto & m : functions)
+    std::lock_guard lock(loadedFilesMutex);
+
+    auto it = loadedFiles.find(path);
+    if (it != loadedFiles.end())
     {
-        if (m.name == name)
-        {
-            return m.parametersFlags;
-        }
+        return it->second;
     }
 
-    throw fmt::format("Unknown function '{}' in class '{}'.", name, fileName);
+    std::span<const u1> contents;
+    if (!helpers::map_file(path, contents))
+    {
+        throw fmt::format("Can't open '{}'.", path);
+    }
+
+    loadedFiles[path] = contents;
+    return contents;
+}
+
+void ClassFile::unloadFile(const std::string & path)
+{
+    std::lock_guard lock(loadedFilesMutex);
+
+    auto it = loadedFiles.find(path);
+    if (it != loadedFiles.end())
+    {
+        helpers::unmap_file(it->second);
+        loadedFiles.erase(it);
+    }
+}
+
+const FunctionData * ClassFile::findFunction(std::string_view name, std::string_view descriptor) const
+{
+    auto it = functionIndex.find({ name, descriptor });
+    return (it != functionIndex.end()) ? &functions[it->second] : nullptr;
+}
+
+const std::vector<u1> & ClassFile::getFunctionFlags(std::string_view name, std::string_view descriptor) const
+{
+    if (auto f = findFunction(name, descriptor))
+    {
+        return f->parametersFlags;
+    }
+
+    throw fmt::format("Unknown function '{}{}' in class '{}'.", name, descriptor, fileName);
+}
+
+std::optional<Value> ClassFile::fieldConstant(std::string_view name) const
+{
+    auto it = fieldIndex.find(name);
+    if (it == fieldIndex.end())
+    {
+        return {};
+    }
+
+    auto & field = fields[it->second];
+    if (!field.constantValue || (field.flags & (ACC_STATIC | ACC_FINAL)) != (ACC_STATIC | ACC_FINAL))
+    {
+        return {};
+    }
+
+    return std::visit([](auto && arg) -> std::optional<Value> {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, s4> || std::is_same_v<T, s8> || std::is_same_v<T, float> || std::is_same_v<T, double>)
+        {
+            return arg;
+        }
+        else
+        {
+            return {};
+        }
+    }, constantPool[field.constantValue]);
 }
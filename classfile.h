@@ -2,68 +2,80 @@
 #define CLASSFILE_H
 
 #include "globals.h"
+#include <cmath>
+#include <limits>
 
-enum class OpType
+// What a decoded line does, turned into C++ by generateCodeFromOperation.
+struct StoreOp
 {
-    Store,
-    Cond,
-    Inc,
-    Jump,
-    IndexedStore,
-    Return,
-    Call,
+    std::optional<std::string> type;
+    std::optional<int> size;
+    u4 position;
+    std::string arr_type;
+    int index;
+    std::optional<std::string> value;
+    std::vector<std::string> populate;
 };
 
-struct Operation
+struct CondOp
 {
-    OpType type;
+    std::string left;
+    std::string right;
+    u4 absolute;
+    std::string op;
+};
 
-    struct
-    {
-        std::optional<std::string> type;
-        std::optional<int> size;
-        u4 position;
-        std::string arr_type;
-        int index;
-        std::optional<std::string> value;
-        std::vector<std::string> populate;
-    } store;
-
-    struct
-    {
-        std::string left;
-        std::string right;
-        u4 absolute;
-        std::string op;
-    } cond;
+struct IncOp
+{
+    int index;
+    int constant;
+};
 
-    struct
-    {
-        int index;
-        int constant;
-    } inc;
+struct JumpOp
+{
+    u4 absolute;
+};
 
-    struct
-    {
-        u4 absolute;
-    } jump;
+struct IndexedStoreOp
+{
+    std::string array;
+    std::string index;
+    std::string value;
+};
 
-    struct
-    {
-        std::string array;
-        std::string index;
-        std::string value;
-    } istore;
+struct ReturnOp
+{
+    std::optional<std::string> value;
+};
 
-    struct
-    {
-        std::optional<std::string> value;
-    } ret;
+struct CallOp
+{
+    std::string code;
+};
+
+using Operation = std::variant<StoreOp, CondOp, IncOp, JumpOp, IndexedStoreOp, ReturnOp, CallOp>;
 
-    struct
+// Expression on the operand stack, allocated in the arena of the method.
+// It is only rendered to C++ once an operation or a call needs its text, so
+// nested arithmetic isn't formatted again at every level.
+struct Expr
+{
+    enum class Kind
     {
-        std::string code;
-    } call;
+        Text,   // local, literal or name, as is
+        Binary, // (left text right)
+        Prefix, // text left
+        Cast,   // static_cast<text>(left)
+        Index,  // left[right]
+        Member, // left.text, or text alone
+        Call,   // left.text(args), or text(args)
+    };
+
+    Kind kind;
+    std::string_view text = {};
+    const Expr * left = nullptr;
+    const Expr * right = nullptr;
+    std::span<const Expr * const> args = {};
 };
 
 struct Array
@@ -80,46 +92,179 @@ struct Object
     std::string ctor;
 };
 
-using Value = std::variant<int32_t, int64_t, float, double, std::string, Array, Object>;
+using Value = std::variant<int32_t, int64_t, float, double, const Expr *, Array, Object>;
+
+std::string getAsString(const Value & value);
+
+// f2i and d2i: NaN gives 0, out of range values saturate
+template<typename F>
+int32_t javaToInt(F value)
+{
+    if (std::isnan(value)) return 0;
+    if (value <= static_cast<F>(std::numeric_limits<int32_t>::min())) return std::numeric_limits<int32_t>::min();
+    if (value >= static_cast<F>(std::numeric_limits<int32_t>::max())) return std::numeric_limits<int32_t>::max();
+    return static_cast<int32_t>(value);
+}
+
+// Fieldref and Methodref entries of the constant pool, resolved once before
+// decompiling so the opcodes don't walk the pool again.
+struct ResolvedFieldRef
+{
+    std::string_view className;
+    std::string_view name;
+    std::string_view descriptor;
+    std::string_view cppName; // qualified, except for the board class and arduino/std, interned
+};
+
+struct ResolvedMethodRef
+{
+    std::string_view className;
+    std::string_view name;
+    std::string_view descriptor;
+    std::string_view cppName; // qualified, except for the board class and arduino/std, interned
+    std::string_view cppClassName;
+    std::optional<u4> argsCount; // unset when the descriptor can't be converted
+    std::string_view returnType;
+    std::string error; // why argsCount is unset, thrown on use
+
+    u4 args() const;
+};
+
+using ResolvedRef = std::variant<std::monostate, ResolvedFieldRef, ResolvedMethodRef>;
+
+struct MethData
+{
+    std::string_view name; // interned
+    std::string_view descriptor;
+    u1 returnFlags; // return flag
+    std::vector<u1> flags; // parameters' flags
+    std::span<const u1> buffer; // "Code" attribute, empty for native methods
+    u2 access = 0; // ACC_* flags
+};
+
+// Identifies a method of a class, overloads included.
+struct SymbolKey
+{
+    std::string_view name;
+    std::string_view descriptor;
+
+    bool operator==(const SymbolKey &) const = default;
+};
+
+struct SymbolKeyHash
+{
+    size_t operator()(const SymbolKey & key) const
+    {
+        return std::hash<std::string_view>{}(key.name) * 31 + std::hash<std::string_view>{}(key.descriptor);
+    }
+};
+
+class Project;
 
 class ClassFile
 {
 public:
-    ClassFile(std::string filename, std::string projectName, bool partial = false);
+    ClassFile(std::string filename);
 
+    static std::string classPath(std::string filename);
+    void decompile(const Project & owner);
+    void resolveReferences();
     bool hasBoard() const;
     std::string boardName() const;
-    void generate(const std::vector<ClassFile> & files, Board board);
-
-    std::vector<Instruction> lineAnalyser(Buffer & buffer, const std::string & name, std::vector<std::tuple<u2, u2>> lineNumbers);
-    std::vector<Instruction> decodeBytecodeLine(Buffer & buffer, const std::string & name, u4 position);
-    std::string generateCodeFromOperation(Operation operation, u4 start_pc, bool & addOpeningParen);
-    u2 getLineFromOpcode(u2 opcode);
-    u2 getOpcodeFromLine(u2 line);
-    int findLocal(int index);
-    std::string getStringFromUtf8(int index);
+    std::vector<std::string> generate(const std::vector<ClassFile> & files, Board board); // returns the written files
+    std::string_view getStringFromUtf8(int index) const;
 
     std::vector<FunctionData> functions;
     std::vector<FieldData> fields;
+    std::unordered_map<SymbolKey, size_t, SymbolKeyHash> functionIndex; // index in functions
+    std::unordered_map<std::string_view, size_t> fieldIndex; // index in fields
+    std::vector<MethData> methodsToDecompile;
     ConstantPool constantPool;
+    std::vector<ResolvedRef> resolvedPool; // same indices as constantPool
     std::vector<std::string> callbacksMethods;
-    std::vector<std::unordered_map<u4, u4>> localsTypes;
-    std::vector<Instruction> insts;
-    std::unordered_map<u4, u4> closingBraces;
-    std::set<u4> skippedGotos;
-    std::multiset<u4> closingBrackets, elseStmts;
-    std::vector<Value> stack;
     std::string board_name;
+    std::string profile_name;
     std::string fileName;
     std::string filePath;
-    Buffer * fullBuffer = nullptr;
-    std::vector<std::tuple<u2, u2>> * lines = nullptr;
     std::string project_name;
+    const Project * project = nullptr;
     std::vector<std::string> rawCMake;
     std::unordered_map<std::string, s4> gbConfig;
+    std::vector<Resource> resources; // images used by the class (Gamebuino)
+
+    static inline std::unordered_map<std::string, std::span<const u1>> loadedFiles;
+    static inline std::mutex loadedFilesMutex;
+    static std::span<const u1> loadFile(const std::string & path);
+    static void unloadFile(const std::string & path); // no ClassFile may use it anymore
+    const FunctionData * findFunction(std::string_view name, std::string_view descriptor) const;
+    const std::vector<u1> & getFunctionFlags(std::string_view name, std::string_view descriptor) const;
+    std::optional<Value> fieldConstant(std::string_view name) const; // static final numbers only
+};
 
-    static inline std::vector<ClassFile> partialClasses;
-    std::vector<u1> getFunctionFlags(std::string name);
+// LineNumberTable of a method, indexed once for the pc <-> line lookups.
+// Entries whose line goes backwards are ignored and the last entry is only
+// used past every other pc, as the decompiler always did.
+class LineIndex
+{
+public:
+    LineIndex(const std::vector<std::tuple<u2, u2>> & lineNumbers);
+
+    u2 lineFromPc(u4 pc) const;
+    std::optional<u2> pcFromLine(u2 line) const;
+    std::optional<u2> nextLine(u4 from, u4 end, u2 line) const; // first line after "line" at a pc in [from, end)
+
+    std::vector<u4> stepPcs; // increasing, stepLines[i] is the line of the pcs up to stepPcs[i]
+    std::vector<u2> stepLines;
+    u2 lastLine = 0;
+    std::unordered_map<u2, u2> firstPc; // line -> pc of its first entry
+};
+
+// Decompilation state of a single method.
+// The class is only read, except its fields whose initial values are set
+// while decompiling <clinit>, so several methods can be decompiled at once.
+class MethodDecompiler
+{
+public:
+    MethodDecompiler(ClassFile & owner);
+
+    std::vector<Instruction> lineAnalyser(std::span<const u1> code, const std::string & name, std::vector<std::tuple<u2, u2>> lineNumbers);
+    std::pmr::vector<Instruction> decodeBytecodeLine(Reader & buffer, const std::string & name, u4 position);
+    std::string generateCodeFromOperation(const Operation & operation, u4 start_pc, bool & addOpeningParen);
+    u2 getLineFromOpcode(u2 opcode);
+    u2 getOpcodeFromLine(u2 line);
+    int findLocal(int index);
+    std::string_view keep(std::string_view text); // copied in the arena
+    const Expr * makeExpr(const Expr & node);
+    const Expr * makeText(std::string_view text);
+    const Expr * toExpr(const Value & value);
+    std::span<const Expr *> makeArgs(size_t count);
+    Value arithmetic(u1 opcode, const Value & left, const Value & right);
+    template<typename T> Value arithmetic(std::string_view op, const Value & left, const Value & right);
+    Value convert(u1 opcode, const Value & value);
+    std::string_view getStringFromUtf8(int index) const { return owner.getStringFromUtf8(index); }
+    bool hasBoard() const { return owner.hasBoard(); }
+
+    const ClassFile & owner;
+    const ConstantPool & constantPool;
+    const std::vector<ResolvedRef> & resolvedPool;
+    const std::vector<FunctionData> & functions;
+    std::vector<FieldData> & fields;
+    const std::vector<std::string> & callbacksMethods;
+    const std::string & project_name;
+    const Project * project;
+
+    // scratch memory of the method, only released with the decompiler
+    std::pmr::monotonic_buffer_resource arena { 16 * 1024 };
+
+    std::pmr::vector<std::pmr::unordered_map<u4, u4>> localsTypes { &arena };
+    std::vector<Instruction> insts;
+    std::pmr::unordered_map<u4, u4> closingBraces { &arena };
+    std::pmr::set<u4> skippedGotos { &arena };
+    std::pmr::multiset<u4> closingBrackets { &arena }, elseStmts { &arena };
+    std::pmr::vector<Value> stack { &arena };
+    std::span<const u1> fullBuffer;
+    std::optional<LineIndex> lines;
+    std::vector<Resource> resources; // added to the build once every method is done
 };
 
 #endif // CLASSFILE_H
@@ -4,6 +4,7 @@
 #define DEBUG
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <variant>
 #include <optional>
@@ -15,7 +16,10 @@
 #include <optional>
 #include <unordered_map>
 #include <filesystem>
+#include <mutex>
+#include <memory_resource>
 #include <set>
+#include <span>
 #include <utility>
 #include <boost/algorithm/string/replace.hpp>
 
@@ -37,23 +41,48 @@ struct Instruction
     std::string opcode;
 };
 
+// names, descriptors and types are interned
 struct FunctionData
 {
-    std::string name;
-    std::string descriptor;
+    std::string_view name;
+    std::string_view descriptor;
     std::vector<Instruction> instructions;
     u2 flags;
     u1 returnFlags;
     std::vector<u1> parametersFlags;
+    bool reachable = true; // from the entry points, or not emitted
+    bool external = true; // called by the board runtime or user code, or internal linkage
+    bool inlined = false; // short and not recursive, emitted inline
 };
 
 struct FieldData
 {
-    std::string name;
-    std::string type;
+    std::string_view name;
+    std::string_view type;
     bool isArray;
     u2 flags;
     std::optional<std::string> init = {};
+    u2 constantValue = 0; // ConstantValue attribute, index in the constant pool
+    bool constantInit = false; // init computed at transpile time, numbers only
+    bool written = false; // static array whose elements are written after <clinit>
+    bool reachable = true; // used by a reachable method, or not emitted
+};
+
+// newarray types, T_STRING to T_ARRAY are only used for the locals
+enum
+{
+    T_NONE    = 0,
+    T_STRING  = 1,
+    T_OBJECT  = 2,
+    T_ARRAY   = 3,
+    T_BOOLEAN = 4,
+    T_CHAR    = 5,
+    T_FLOAT   = 6,
+    T_DOUBLE  = 7,
+    T_BYTE    = 8,
+    T_SHORT   = 9,
+    T_INT     = 10,
+    T_LONG    = 11,
 };
 
 enum
@@ -75,11 +104,26 @@ enum
     ldc_w = 0x13,
     ldc2_w = 0x14,
     iload = 0x15,
+    lload = 0x16,
+    fload = 0x17,
+    dload = 0x18,
     aload = 0x19,
     iload_0 = 0x1a,
     iload_1 = 0x1b,
     iload_2 = 0x1c,
     iload_3 = 0x1d,
+    lload_0 = 0x1e,
+    lload_1 = 0x1f,
+    lload_2 = 0x20,
+    lload_3 = 0x21,
+    fload_0 = 0x22,
+    fload_1 = 0x23,
+    fload_2 = 0x24,
+    fload_3 = 0x25,
+    dload_0 = 0x26,
+    dload_1 = 0x27,
+    dload_2 = 0x28,
+    dload_3 = 0x29,
     aload_0 = 0x2a,
     aload_1 = 0x2b,
     aload_2 = 0x2c,
@@ -101,9 +145,10 @@ enum
     istore_1 = 0x3c,
     istore_2 = 0x3d,
     istore_3 = 0x3e,
-    lstore_0 = 0x40,
-    lstore_1 = 0x41,
-    lstore_2 = 0x42,
+    lstore_0 = 0x3f,
+    lstore_1 = 0x40,
+    lstore_2 = 0x41,
+    lstore_3 = 0x42,
     fstore_0 = 0x43,
     fstore_1 = 0x44,
     fstore_2 = 0x45,
@@ -122,6 +167,8 @@ enum
     dastore = 0x52,
     aastore = 0x53,
     bastore = 0x54,
+    castore = 0x55,
+    sastore = 0x56,
     pop = 0x57,
     dup_ = 0x59,
     iadd = 0x60,
@@ -182,13 +229,84 @@ enum
 };
 
 using Buffer = std::vector<u1>;
-u1 read8(Buffer & buffer);
-u2 read16(Buffer & buffer);
-u4 read32(Buffer & buffer);
 
-s1 reads8(Buffer & buffer);
-s2 reads16(Buffer & buffer);
-s4 reads32(Buffer & buffer);
+// Big-endian cursor over bytes owned by someone else. Reading never copies
+// nor shifts the underlying data, and running past the end throws.
+// Several views can be chained with append() before reading, they are then
+// read as if they were contiguous.
+class Reader
+{
+public:
+    Reader() = default;
+    Reader(std::span<const u1> bytes) : bytes(bytes), total(bytes.size()) {}
+
+    void append(std::span<const u1> next)
+    {
+        if (bytes.empty())
+        {
+            bytes = next;
+        }
+        else
+        {
+            chained.push_back(next);
+        }
+        total += next.size();
+    }
+
+    u1 next()
+    {
+        while (cursor == bytes.size())
+        {
+            if (link == chained.size())
+            {
+                throw fmt::format("Unexpected end of buffer after {} bytes.", consumed);
+            }
+            bytes = chained[link++];
+            cursor = 0;
+        }
+
+        ++consumed;
+        return bytes[cursor++];
+    }
+
+    std::span<const u1> view(size_t length)
+    {
+        while (cursor == bytes.size() && link < chained.size())
+        {
+            bytes = chained[link++];
+            cursor = 0;
+        }
+
+        if (length > bytes.size() - cursor)
+        {
+            throw fmt::format("Trying to read {} bytes, only {} left.", length, bytes.size() - cursor);
+        }
+
+        auto sub = bytes.subspan(cursor, length);
+        cursor += length;
+        consumed += length;
+        return sub;
+    }
+
+    size_t size() const { return total - consumed; }
+    size_t tell() const { return consumed; }
+
+private:
+    std::span<const u1> bytes;
+    std::vector<std::span<const u1>> chained;
+    size_t link = 0;
+    size_t cursor = 0;
+    size_t consumed = 0;
+    size_t total = 0;
+};
+
+u1 read8(Reader & buffer);
+u2 read16(Reader & buffer);
+u4 read32(Reader & buffer);
+
+s1 reads8(Reader & buffer);
+s2 reads16(Reader & buffer);
+s4 reads32(Reader & buffer);
 
 #define r8()  read8(buffer)
 #define r16() read16(buffer)
@@ -237,6 +355,31 @@ enum class Board
     Picosystem,
 };
 
+// optimisation of the firmware, from @Profile on the board class or --profile
+enum class Profile
+{
+    Default, // left to the SDK or the Arduino core
+    Speed,
+    Size,
+    Debug,
+};
+
+// what a profile adds to the build of every backend
+struct ProfileFlags
+{
+    std::string compile; // C and C++
+    std::string link;
+    bool lto = false;
+};
+
+// dithering of the Indexed images of the Gamebuino, from --dither
+enum class Dither
+{
+    None,
+    Ordered, // 4x4 Bayer matrix
+    FloydSteinberg,
+};
+
 struct Fieldref
 {
     u2 class_index;
@@ -291,14 +434,14 @@ struct NameAndType
 struct Utf8
 {
     u2 length;
-    Buffer bytes;
+    std::string_view bytes;
 };
 
 struct attribute_info
 {
     u2 attribute_name_index;
     u4 attribute_length;
-    Buffer info;
+    std::span<const u1> info;
 };
 
 struct method_info
@@ -327,12 +470,15 @@ using Constant = std::variant<std::monostate
                             , s8>;
 using ConstantPool = std::vector<Constant>;
 
-u4 countArgs(std::string str);
-std::string getReturnType(std::string descriptor, u1 flags);
-std::string generateParameters(std::string descriptor, std::vector<u1> flags, bool isMethod);
+u4 countArgs(std::string_view str);
+std::string_view getReturnType(std::string_view descriptor, u1 flags);
+std::string_view generateParameters(std::string_view descriptor, const std::vector<u1> & flags, bool isMethod);
 Board getBoardTypeFromString(std::string board_name);
+Profile getProfileFromString(std::string profile_name);
+ProfileFlags getProfileFlags(Profile profile);
+Dither getDitherFromString(std::string dither_name);
 void copyUserFiles(std::filesystem::path currentPath);
-std::string getTypeFromDescriptor(std::string descriptor, u8 flags);
+std::string_view getTypeFromDescriptor(std::string_view descriptor, u8 flags);
 
 #define STATIC_INIT "<clinit>"
 #define CONSTRUCTOR "<init>"
@@ -341,6 +487,17 @@ enum class Format
 {
     Rgb565,
     Indexed,
+    Rgb565Lz,   // compressed, decoded one frame at a time on the device
+    IndexedRle, // same
+};
+
+struct Resource
+{
+    std::string filename;
+    Format format;
+    int xcount = 1;
+    int ycount = 1;
+    int loop = 0;
 };
 
 std::string javaToCpp(std::string name);
@@ -2,12 +2,23 @@
 #define HELPERS_H
 
 #include <string>
+#include <span>
+#include <cstdint>
+#include <vector>
 
 namespace helpers
 {
     bool can_execute(std::string exename);
     bool execute(std::string exename, std::string args = "");
     bool copy(std::string source, std::string destination);
+    // sets an environment variable, inherited by the commands run afterwards
+    void set_env(std::string name, std::string value);
+    // maps the whole file read-only. The mapping lives until the end of the process.
+    bool map_file(std::string filename, std::span<const uint8_t> & contents);
+    void unmap_file(std::span<const uint8_t> contents);
+    // blocks until files of the directory are written, created or deleted and
+    // returns their names. Only the directory of the first call is watched.
+    bool wait_for_changes(std::string directory, std::vector<std::string> & files);
 }
 
 #endif // HELPERS_H
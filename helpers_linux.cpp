@@ -1,5 +1,12 @@
 #include "helpers.h"
 #include <fmt/format.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cstdlib>
 
 #ifdef DEBUG
 #define OUTPUT ""
@@ -22,10 +29,98 @@ bool execute(std::string exename, std::string args)
     return system(cmd.data()) == 0;
 }
 
+void set_env(std::string name, std::string value)
+{
+    setenv(name.data(), value.data(), 1);
+}
+
 bool copy(std::string source, std::string destination)
 {
     auto cmd = fmt::format("cp {} {} {}", source, destination, OUTPUT);
     return system(cmd.data()) == 0;
 }
 
+bool map_file(std::string filename, std::span<const uint8_t> & contents)
+{
+    int fd = open(filename.data(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    contents = {};
+    if (st.st_size > 0)
+    {
+        void * data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+
+        contents = { static_cast<const uint8_t*>(data), static_cast<size_t>(st.st_size) };
+    }
+
+    close(fd);
+    return true;
+}
+
+void unmap_file(std::span<const uint8_t> contents)
+{
+    if (contents.size())
+    {
+        munmap(const_cast<uint8_t*>(contents.data()), contents.size());
+    }
+}
+
+bool wait_for_changes(std::string directory, std::vector<std::string> & files)
+{
+    static int fd = -1;
+    if (fd < 0)
+    {
+        fd = inotify_init1(IN_CLOEXEC);
+        if (fd < 0 || inotify_add_watch(fd, directory.data(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0)
+        {
+            return false;
+        }
+    }
+
+    files.clear();
+
+    // waits for the first event, then gathers the ones closely following it
+    // as editors save a file in several steps
+    alignas(inotify_event) char events[4096];
+    pollfd pfd { fd, POLLIN, 0 };
+    int timeout = -1;
+    while (poll(&pfd, 1, timeout) > 0)
+    {
+        auto length = read(fd, events, sizeof(events));
+        if (length <= 0)
+        {
+            return false;
+        }
+
+        for (char * ptr = events; ptr < events + length; )
+        {
+            auto event = reinterpret_cast<const inotify_event*>(ptr);
+            if (event->len)
+            {
+                files.push_back(event->name);
+            }
+            ptr += sizeof(inotify_event) + event->len;
+        }
+
+        timeout = 50;
+    }
+
+    return true;
+}
+
 }
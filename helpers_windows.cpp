@@ -1,5 +1,6 @@
 #include "helpers.h"
 #include <fmt/format.h>
+#include <windows.h>
 
 namespace helpers
 {
@@ -16,10 +17,130 @@ bool execute(std::string exename, std::string args)
     return system(cmd.data()) == 0;
 }
 
+void set_env(std::string name, std::string value)
+{
+    _putenv_s(name.data(), value.data());
+}
+
 bool copy(std::string source, std::string destination)
 {
     auto cmd = fmt::format("copy {} {}", source, destination);
     return system(cmd.data()) == 0;
 }
 
+bool map_file(std::string filename, std::span<const uint8_t> & contents)
+{
+    HANDLE file = CreateFileA(filename.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    contents = {};
+    if (size.QuadPart > 0)
+    {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        auto data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!data)
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        contents = { static_cast<const uint8_t*>(data), static_cast<size_t>(size.QuadPart) };
+    }
+
+    CloseHandle(file);
+    return true;
+}
+
+void unmap_file(std::span<const uint8_t> contents)
+{
+    if (contents.size())
+    {
+        UnmapViewOfFile(contents.data());
+    }
+}
+
+bool wait_for_changes(std::string directory, std::vector<std::string> & files)
+{
+    static HANDLE dir = INVALID_HANDLE_VALUE;
+    static HANDLE event = nullptr;
+    if (dir == INVALID_HANDLE_VALUE)
+    {
+        dir = CreateFileA(directory.data(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                          nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+        event = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+        if (dir == INVALID_HANDLE_VALUE || !event)
+        {
+            return false;
+        }
+    }
+
+    files.clear();
+
+    // waits for the first changes, then gathers the ones closely following
+    // them as editors save a file in several steps
+    alignas(FILE_NOTIFY_INFORMATION) char buffer[4096];
+    DWORD timeout = INFINITE;
+    for (;;)
+    {
+        OVERLAPPED overlapped {};
+        overlapped.hEvent = event;
+        ResetEvent(event);
+        if (!ReadDirectoryChangesW(dir, buffer, sizeof(buffer), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE,
+                                   nullptr, &overlapped, nullptr))
+        {
+            return false;
+        }
+
+        DWORD length;
+        if (WaitForSingleObject(event, timeout) == WAIT_TIMEOUT)
+        {
+            // the directory keeps recording the changes for the next call
+            CancelIo(dir);
+            GetOverlappedResult(dir, &overlapped, &length, TRUE);
+            break;
+        }
+
+        if (!GetOverlappedResult(dir, &overlapped, &length, FALSE))
+        {
+            return false;
+        }
+
+        for (char * ptr = buffer; length; )
+        {
+            auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(ptr);
+            int size = WideCharToMultiByte(CP_UTF8, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), nullptr, 0, nullptr, nullptr);
+            std::string name(size, '\0');
+            WideCharToMultiByte(CP_UTF8, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), name.data(), size, nullptr, nullptr);
+            files.push_back(name);
+
+            if (!info->NextEntryOffset)
+            {
+                break;
+            }
+            ptr += info->NextEntryOffset;
+        }
+
+        timeout = 50;
+    }
+
+    return true;
+}
+
 }
@@ -0,0 +1,17 @@
+#include "interner.h"
+#include <unordered_set>
+
+std::string_view intern(std::string_view str)
+{
+    static std::mutex mutex;
+    static std::unordered_set<std::string, StringHash, std::equal_to<>> strings;
+
+    std::lock_guard lock(mutex);
+
+    auto it = strings.find(str);
+    if (it == strings.end())
+    {
+        it = strings.emplace(str).first;
+    }
+    return *it;
+}
@@ -0,0 +1,49 @@
+#ifndef INTERNER_H
+#define INTERNER_H
+
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Returns the process-wide copy of the string, created on first use.
+// The view stays valid until the end of the process (even once the class file
+// it came from is unloaded), identical names and descriptors share it.
+std::string_view intern(std::string_view str);
+
+struct StringHash
+{
+    using is_transparent = void;
+    size_t operator()(std::string_view str) const { return std::hash<std::string_view>{}(str); }
+};
+
+// Thread-safe cache of a pure function of a string, e.g. descriptor parsing.
+// Looking up an existing key doesn't allocate, the values never move.
+template<typename Value>
+class Memo
+{
+public:
+    // compute() is only called on a miss, nothing is cached if it throws
+    template<typename F>
+    const Value & get(std::string_view key, F compute)
+    {
+        {
+            std::lock_guard lock(mutex);
+            auto it = values.find(key);
+            if (it != values.end())
+            {
+                return it->second;
+            }
+        }
+
+        auto value = compute();
+
+        std::lock_guard lock(mutex);
+        return values.try_emplace(std::string(key), std::move(value)).first->second;
+    }
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Value, StringHash, std::equal_to<>> values;
+};
+
+#endif // INTERNER_H
@@ -2,6 +2,7 @@ TEMPLATE = app
 CONFIG += console
 CONFIG -= app_bundle
 CONFIG -= qt
+CONFIG += thread
 QMAKE_CXXFLAGS += -std=c++2b
 
 LIBS += -lfmt
@@ -10,19 +11,35 @@ TARGET = pico-java
 
 SOURCES += \
         boards/gamebuino.cpp \
+        boards/palette.cpp \
         boards/pico.cpp \
+        boards/pixels.cpp \
         boards/picosystem.cpp \
+        buildcache.cpp \
         classfile.cpp \
-        main.cpp
+        interner.cpp \
+        main.cpp \
+        parallel.cpp \
+        project.cpp \
+        reachability.cpp \
+        staticinit.cpp
 
 unix:SOURCES += helpers_linux.cpp
 win32:SOURCES += helpers_windows.cpp
 
 HEADERS += \
     boards/gamebuino.h \
+    boards/palette.h \
     boards/pico.h \
+    boards/pixels.h \
     boards/picosystem.h \
+    buildcache.h \
     classfile.h \
     globals.h \
     helpers.h \
+    interner.h \
+    parallel.h \
+    project.h \
+    reachability.h \
+    staticinit.h \
     stb_image.h
@@ -0,0 +1,8 @@
+package board;
+
+public enum Optimize
+{
+	Speed,
+	Size,
+	Debug,
+}
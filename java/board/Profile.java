@@ -0,0 +1,6 @@
+package board;
+
+public @interface Profile
+{
+	board.Optimize value();
+}
@@ -4,4 +4,6 @@ public enum Format
 {
 	Rgb565,
 	Indexed,
+	Rgb565Lz,
+	IndexedRle,
 }
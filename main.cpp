@@ -1,50 +1,57 @@
 #include "globals.h"
+#include "project.h"
+#include "parallel.h"
+#include "helpers.h"
+#include "buildcache.h"
+#include "interner.h"
 #include "boards/pico.h"
 #include "boards/gamebuino.h"
 #include "boards/picosystem.h"
 #include <bit>
+#include <sstream>
 
-u4 countArgs(std::string str)
+u4 countArgs(std::string_view str)
 {
-    int count = 0;
-    if (str[0] != '(')
-    {
-        throw fmt::format("Invalid descriptor. Should start with '(', got '{}'!", str[0]);
-    }
+    static Memo<u4> memo;
+    return memo.get(str, [&]() -> u4 {
+        int count = 0;
+        if (str[0] != '(')
+        {
+            throw fmt::format("Invalid descriptor. Should start with '(', got '{}'!", str[0]);
+        }
 
-    for (size_t index = 1; index < str.size(); ++index)
-    {
-        switch (str[index])
+        for (size_t index = 1; index < str.size(); ++index)
         {
-        case ')':
-            index = str.size();
-            break;
-        case 'L':
-            ++count;
-            while (str[index] != ';') ++index;
-            break;
-        case 'I':
-        case 'Z':
-        case 'F':
-        case 'B':
-        case 'S':
-            ++count;
-            break;
-        case '[':
-            break;
-        default:
-            throw fmt::format("Invalid or unhandled type used as a parameter type: '{}'.", str[index]);
+            switch (str[index])
+            {
+            case ')':
+                index = str.size();
+                break;
+            case 'L':
+                ++count;
+                while (str[index] != ';') ++index;
+                break;
+            case 'I':
+            case 'Z':
+            case 'F':
+            case 'B':
+            case 'S':
+                ++count;
+                break;
+            case '[':
+                break;
+            default:
+                throw fmt::format("Invalid or unhandled type used as a parameter type: '{}'.", str[index]);
+            }
         }
-    }
 
-    return count;
+        return count;
+    });
 }
 
-attribute_info readAttribute(Buffer & buffer);
-
-std::vector<Instruction> convertBytecode(Buffer & buffer, std::string function, u2 depth);
+attribute_info readAttribute(Reader & buffer);
 
-int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+std::vector<std::string> findJavaFiles()
 {
     std::vector<std::string> javaFiles;
     for (auto const& dir_entry : std::filesystem::directory_iterator{"."})
@@ -59,67 +66,182 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
         }
     }
 
-    if (!javaFiles.size())
+    return javaFiles;
+}
+
+bool compileJava(const std::vector<std::string> & javaFiles, const std::string & options)
+{
+    // one JVM for every file, its diagnostics name the files with errors
+    int r = system(fmt::format("javac {} {}", options, fmt::join(javaFiles, " ")).data());
+    if (r != 0)
     {
-        fmt::print("No .java file detected. Aborting.\n");
-        return 0;
+        fmt::print("Compilation failed.\n");
+        return false;
     }
 
-    for (auto & file : javaFiles)
-    {
-        int r = system(fmt::format("javac -cp api {}", file).data());
+    return true;
+}
 
-        if (r != 0)
-        {
-            fmt::print("{} has errors. Aborting.\n", file);
-            return 0;
-        }
+void build(Project & project)
+{
+    auto board = getBoardTypeFromString(project.board_name);
+    if (board == Board::Gamebuino)
+    {
+        build_gamebuino(project);
+    }
+    else if (board == Board::Picosystem)
+    {
+        build_picosystem(project);
+    }
+    else
+    {
+        build_pico(project, board);
     }
 
-    try
+    fmt::print("\n");
+}
+
+// Builds again each time a .java file changes. Every source is compiled
+// again in one javac run, as javac copies the static final constants of a
+// class into the classes using it, then parsed again. The build cache skips
+// the generation of the sources whose class files didn't change.
+void watch(Project & project)
+{
+    auto projectPath = fs::current_path();
+    auto separator = (fs::path::preferred_separator == '\\') ? ';' : ':';
+
+    fmt::print("Watching '{}' for changes...\n", projectPath.string());
+
+    std::vector<std::string> changes;
+    while (helpers::wait_for_changes(projectPath.string(), changes))
     {
-        std::string project_name, board_name;
-        for (auto & file : javaFiles)
+        std::set<std::string> touched;
+        for (auto & file : changes)
         {
-            ClassFile tmp(file, ""s, true);
-            if (tmp.hasBoard())
+            if (file.ends_with(".java"))
             {
-                project_name = tmp.fileName;
-                board_name = tmp.boardName();
+                touched.insert(file);
             }
         }
 
-        for (const fs::directory_entry& dir_entry :
-                fs::recursive_directory_iterator("."))
+        if (touched.empty())
         {
-            if (dir_entry.is_regular_file() && dir_entry.path().extension().string() == ".class")
+            continue;
+        }
+
+        // javac rewrites the class files in place, deleted files included
+        auto javaFiles = findJavaFiles();
+        std::vector<std::string> stale(javaFiles);
+        stale.insert(stale.end(), touched.begin(), touched.end());
+        project.unload(stale);
+        bool compiled = javaFiles.empty() || compileJava(javaFiles, fmt::format("-cp api{}. -implicit:none", separator));
+
+        try
+        {
+            project.load(javaFiles);
+            if (compiled)
             {
-                ClassFile tmp(dir_entry.path().string(), ""s, true);
-                ClassFile::partialClasses.push_back(tmp);
+                build(project);
             }
         }
-
-        std::vector<ClassFile> classFiles;
-        for (auto & file : javaFiles)
+        catch (const std::string & str)
         {
-            classFiles.push_back(ClassFile(file, project_name));
+            fmt::print("{}\n", str);
         }
 
-        auto board = getBoardTypeFromString(board_name);
-        if (board == Board::Gamebuino)
+        fs::current_path(projectPath);
+    }
+
+    fmt::print("Can't watch '{}'.\n", projectPath.string());
+}
+
+int main(int argc, char** argv)
+{
+    bool watchMode = false;
+    std::string profile;
+    std::string palette;
+    auto dither = Dither::None;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if ((arg == "--jobs" || arg == "-j") && i + 1 < argc)
+        {
+            auto count = std::atoi(argv[++i]);
+            if (count < 1)
+            {
+                fmt::print("Invalid number of jobs: '{}'.\n", argv[i]);
+                return 0;
+            }
+            set_jobs(count);
+        }
+        else if (arg == "--watch" || arg == "-w")
+        {
+            watchMode = true;
+        }
+        else if ((arg == "--profile" || arg == "-p") && i + 1 < argc)
+        {
+            profile = argv[++i];
+            try
+            {
+                getProfileFromString(profile);
+            }
+            catch (const std::string & str)
+            {
+                fmt::print("{}\n", str);
+                return 0;
+            }
+        }
+        else if (arg == "--palette" && i + 1 < argc)
         {
-            build_gamebuino(project_name, classFiles);
+            palette = argv[++i];
         }
-        else if (board == Board::Picosystem)
+        else if (arg == "--dither" && i + 1 < argc)
         {
-            build_picosystem(project_name, classFiles);
+            try
+            {
+                dither = getDitherFromString(argv[++i]);
+            }
+            catch (const std::string & str)
+            {
+                fmt::print("{}\n", str);
+                return 0;
+            }
         }
         else
         {
-            build_pico(project_name, getBoardTypeFromString(board_name), classFiles);
+            fmt::print("Unknown option: '{}'.\n", arg);
+            fmt::print("Usage: {} [--jobs N] [--watch] [--profile speed|size|debug] [--palette image] [--dither none|ordered|floyd]\n", argv[0]);
+            return 0;
         }
+    }
+
+    auto javaFiles = findJavaFiles();
+    if (!javaFiles.size())
+    {
+        fmt::print("No .java file detected. Aborting.\n");
+        return 0;
+    }
+
+    if (!compileJava(javaFiles, "-cp api"))
+    {
+        fmt::print("Aborting.\n");
+        return 0;
+    }
 
-        fmt::print("\n");
+    try
+    {
+        auto projectPath = fs::current_path();
+        Project project(javaFiles);
+        project.profile_option = profile;
+        project.palette_option = palette;
+        project.dither = dither;
+        build(project);
+
+        if (watchMode)
+        {
+            fs::current_path(projectPath);
+            watch(project);
+        }
     }
     catch (const std::string & str)
     {
@@ -129,14 +251,12 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
     return 0;
 }
 
-u1 read8(Buffer & buffer)
+u1 read8(Reader & buffer)
 {
-    auto byte = buffer.front();
-    buffer.erase(buffer.begin());
-    return byte;
+    return buffer.next();
 }
 
-u2 read16(Buffer & buffer)
+u2 read16(Reader & buffer)
 {
     auto MSB = read8(buffer);
     auto LSB = read8(buffer);
@@ -144,7 +264,7 @@ u2 read16(Buffer & buffer)
     return MSB << 8 | LSB;
 }
 
-u4 read32(Buffer & buffer)
+u4 read32(Reader & buffer)
 {
     auto MSB = read16(buffer);
     auto LSB = read16(buffer);
@@ -152,77 +272,84 @@ u4 read32(Buffer & buffer)
     return MSB << 16 | LSB;
 }
 
-s1 reads8(Buffer & buffer)
+s1 reads8(Reader & buffer)
 {
     return r8();
 }
 
-s2 reads16(Buffer & buffer)
+s2 reads16(Reader & buffer)
 {
     return r16();
 }
 
-s4 reads32(Buffer & buffer)
+s4 reads32(Reader & buffer)
 {
     return r32();
 }
 
-std::string getReturnType(std::string descriptor, u1 flags)
+std::string_view getReturnType(std::string_view descriptor, u1 flags)
 {
-    auto paren = descriptor.find(')');
-    auto type = descriptor.substr(paren + 1);
-
-    std::string prefix;
-    std::string suffix;
-    if (flags & CONST_TYPE)    prefix += "const ";
-    if (flags & UNSIGNED_TYPE) prefix += "u";
-    if (flags & POINTER_TYPE)  suffix += "*";
-
-    if (type == "V")
-    {
-        return "void";
-    }
-
-    if (type == "I")
-    {
-        return prefix + "int32_t" + suffix;
-    }
-
-    if (type == "B")
-    {
-        return prefix + "int8_t" + suffix;
-    }
+    static Memo<std::string> memo;
+    thread_local std::string key;
+    key.assign(1, static_cast<char>(flags));
+    key += descriptor;
+
+    return memo.get(key, [&]() -> std::string {
+        auto paren = descriptor.find(')');
+        auto type = descriptor.substr(paren + 1);
+
+        std::string prefix;
+        std::string suffix;
+        if (flags & CONST_TYPE)    prefix += "const ";
+        if (flags & UNSIGNED_TYPE) prefix += "u";
+        if (flags & POINTER_TYPE)  suffix += "*";
+
+        if (type == "V")
+        {
+            return "void";
+        }
 
-    if (type == "S")
-    {
-        return prefix + "int16_t" + suffix;
-    }
+        if (type == "I")
+        {
+            return prefix + "int32_t" + suffix;
+        }
 
-    if (type == "Z")
-    {
-        return "bool" + suffix;
-    }
+        if (type == "B")
+        {
+            return prefix + "int8_t" + suffix;
+        }
 
-    if (type == "D")
-    {
-        return prefix + "double" + suffix;
-    }
+        if (type == "S")
+        {
+            return prefix + "int16_t" + suffix;
+        }
 
-    if (type.starts_with("L") && type.ends_with(";"))
-    {
-        auto jt = type.substr(1, type.size() - 2);
+        if (type == "Z")
+        {
+            return "bool" + suffix;
+        }
 
-        if (jt == "java/lang/String")
+        if (type == "D")
         {
-            return prefix + "std::string" + suffix;
+            return prefix + "double" + suffix;
         }
-        else
+
+        if (type.starts_with("L") && type.ends_with(";"))
         {
-            return prefix + javaToCpp(jt) + suffix;
+            auto jt = type.substr(1, type.size() - 2);
+
+            if (jt == "java/lang/String")
+            {
+                return prefix + "std::string" + suffix;
+            }
+            else
+            {
+                return prefix + javaToCpp(std::string(jt)) + suffix;
+            }
         }
-    }
 
-    throw fmt::format("Invalid or unhandled type used as a return type: '{}'.", type);
+        throw fmt::format("Invalid or unhandled type used as a return type: '{}'.", type);
+    });
 }
 
 Board getBoardTypeFromString(std::string board_name)
@@ -240,71 +367,118 @@ Board getBoardTypeFromString(std::string board_name)
     throw fmt::format("Invalid board: '{}'.", board_name);
 }
 
-std::string generateParameters(std::string descriptor, std::vector<u1> flags, bool isMethod)
+Profile getProfileFromString(std::string profile_name)
 {
-    std::string ret;
+    std::transform(begin(profile_name), end(profile_name), begin(profile_name), [](auto c) { return std::tolower(c); });
 
-    int count = isMethod ? 1 : 0;
-    if (descriptor[0] != '(')
+    if (profile_name == "speed") return Profile::Speed;
+    if (profile_name == "size")  return Profile::Size;
+    if (profile_name == "debug") return Profile::Debug;
+
+    throw fmt::format("Invalid profile: '{}'.", profile_name);
+}
+
+ProfileFlags getProfileFlags(Profile profile)
+{
+    switch (profile)
     {
-        throw fmt::format("Invalid descriptor. Should start with '(', got '{}'!", descriptor[0]);
+    case Profile::Speed:
+        return { "-O2 -ffunction-sections -fdata-sections", "-Wl,--gc-sections", true };
+    case Profile::Size:
+        return { "-Os", "", true };
+    case Profile::Debug:
+        return { "-Og -g", "", false };
+    default:
+        return {};
     }
+}
 
-    int arrayCount = 0;
-    for (size_t index = 1; index < descriptor.size(); ++index)
-    {
-        switch (descriptor[index])
+Dither getDitherFromString(std::string dither_name)
+{
+    std::transform(begin(dither_name), end(dither_name), begin(dither_name), [](auto c) { return std::tolower(c); });
+
+    if (dither_name == "none")    return Dither::None;
+    if (dither_name == "ordered") return Dither::Ordered;
+    if (dither_name == "floyd")   return Dither::FloydSteinberg;
+
+    throw fmt::format("Invalid dithering: '{}'.", dither_name);
+}
+
+std::string_view generateParameters(std::string_view descriptor, const std::vector<u1> & flags, bool isMethod)
+{
+    static Memo<std::string> memo;
+    thread_local std::string key;
+    key.assign(1, isMethod);
+    key += static_cast<char>(flags.size());
+    key.append(flags.begin(), flags.end());
+    key += descriptor;
+
+    return memo.get(key, [&] {
+        std::string ret;
+
+        int count = isMethod ? 1 : 0; // local index, "this" being local_0 for methods
+        int first = count;
+        if (descriptor[0] != '(')
         {
-        case ')':
-            index = descriptor.size();
-            break;
-        case 'L':
+            throw fmt::format("Invalid descriptor. Should start with '(', got '{}'!", descriptor[0]);
+        }
+
+        int arrayCount = 0;
+        for (size_t index = 1; index < descriptor.size(); ++index)
         {
-            std::string type;
-            ++index;
-            while (descriptor[index] != ';')
+            switch (descriptor[index])
+            {
+            case ')':
+                index = descriptor.size();
+                break;
+            case 'L':
             {
-                type += descriptor[index];
+                std::string type;
                 ++index;
+                while (descriptor[index] != ';')
+                {
+                    type += descriptor[index];
+                    ++index;
+                }
+
+                if (flags[count - first] & POINTER_TYPE) ++arrayCount;
+
+                if (type == "java/lang/String")
+                {
+                    ret += fmt::format(", std::string {}local_{}", std::string(arrayCount, '*'), count);
+                }
+                else if (type == "pimoroni/buffer")
+                {
+                    ret += fmt::format(", pimoroni::buffer {}local_{}", std::string(arrayCount, '*'), count);
+                }
+                else
+                {
+                    throw fmt::format("classes are not supported as function arguments.");
+                }
+                break;
             }
-
-            if (flags[count] & POINTER_TYPE) ++arrayCount;
-
-            if (type == "java/lang/String")
+            case 'I':
+            case 'Z':
             {
-                ret += fmt::format(", std::string {}local_{}", std::string(arrayCount, '*'), count);
+                ret += fmt::format(", {} {}local_{}", getTypeFromDescriptor(std::string(1, descriptor[index]), flags[count - first]), std::string(arrayCount, '*'), count);
+                arrayCount = 0;
+                ++count;
+                break;
             }
-            else if (type == "pimoroni/buffer")
-            {
-                ret += fmt::format(", pimoroni::buffer {}local_{}", std::string(arrayCount, '*'), count);
+            case '[':
+                ++arrayCount;
+                break;
+            default:
+                throw fmt::format("Invalid character in descriptor: '{}'.", descriptor[index]);
             }
-            else
-            {
-                throw fmt::format("classes are not supported as function arguments.");
-            }
-            break;
         }
-        case 'I':
-        case 'Z':
+
+        if (ret.size() > 0)
         {
-            ret += fmt::format(", {} {}local_{}", getTypeFromDescriptor(descriptor[index]+""s, flags[count]), std::string(arrayCount, '*'), count);
-            arrayCount = 0;
-            ++count;
-            break;
-        }
-        case '[':
-            ++arrayCount;
-            break;
-        default:
-            throw fmt::format("Invalid character in descriptor: '{}'.", descriptor[index]);
+            ret = ret.substr(2);
         }
-    }
-
-    if (ret.size() > 0)
-    {
-        ret = ret.substr(2);
-    }
-    return ret;
+        return ret;
+    });
 }
 
 std::string javaToCpp(std::string name)
@@ -318,7 +492,10 @@ void copyUserFiles(fs::path currentPath)
     {
         if (fs::exists(currentPath / (USER_FILE + ext)))
         {
-            fs::copy_file(currentPath / (USER_FILE + ext), fs::current_path() / (USER_FILE + ext), fs::copy_options::overwrite_existing);
+            std::ifstream input(currentPath / (USER_FILE + ext), std::ios::binary);
+            std::ostringstream content;
+            content << input.rdbuf();
+            writeIfChanged(fs::current_path() / (USER_FILE + ext), content.str());
         }
         else
         {
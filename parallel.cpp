@@ -0,0 +1,235 @@
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+struct Group
+{
+    const std::function<void(size_t)> * job;
+    std::atomic<size_t> pending;
+    std::vector<std::exception_ptr> errors;
+};
+
+struct Task
+{
+    Group * group;
+    size_t index;
+};
+
+struct Worker
+{
+    std::mutex mutex;
+    std::deque<Task> tasks;
+};
+
+// Each worker pops its own tasks from the back and steals the oldest ones
+// of the others from the front.
+// Slot 0 belongs to the threads outside of the pool (i.e. the main thread).
+class Scheduler
+{
+public:
+    ~Scheduler();
+
+    void run(Group & group, size_t count);
+
+    unsigned size = std::max(1u, std::thread::hardware_concurrency());
+
+private:
+    void start();
+    void loop(size_t self);
+    bool pop(size_t self, Task & task);
+    bool steal(size_t self, Task & task);
+    void execute(Task task);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::once_flag started;
+    std::atomic<bool> stopping = false;
+    std::atomic<size_t> queued = 0;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+};
+
+thread_local size_t workerIndex = 0;
+
+Scheduler scheduler;
+
+Scheduler::~Scheduler()
+{
+    stopping = true;
+    {
+        std::lock_guard lock(sleepMutex);
+    }
+    wakeUp.notify_all();
+
+    for (auto & thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void Scheduler::start()
+{
+    for (unsigned i = 0; i < size; ++i)
+    {
+        workers.push_back(std::make_unique<Worker>());
+    }
+
+    for (unsigned i = 1; i < size; ++i)
+    {
+        threads.emplace_back([this, i]() {
+            workerIndex = i;
+            loop(i);
+        });
+    }
+}
+
+void Scheduler::run(Group & group, size_t count)
+{
+    std::call_once(started, [this]() { start(); });
+
+    auto self = workerIndex;
+    queued += count;
+    {
+        auto & worker = *workers[self];
+        std::lock_guard lock(worker.mutex);
+        // pushed backwards so the owner runs them in order
+        for (size_t i = count; i > 0; --i)
+        {
+            worker.tasks.push_back({ &group, i - 1 });
+        }
+    }
+
+    {
+        std::lock_guard lock(sleepMutex);
+    }
+    wakeUp.notify_all();
+
+    while (group.pending > 0)
+    {
+        Task task;
+        if (pop(self, task) || steal(self, task))
+        {
+            execute(task);
+        }
+        else
+        {
+            // the last tasks run elsewhere, sleeps until they are done or
+            // new tasks are queued
+            std::unique_lock lock(sleepMutex);
+            wakeUp.wait(lock, [&]() { return group.pending == 0 || queued > 0; });
+        }
+    }
+}
+
+void Scheduler::loop(size_t self)
+{
+    while (!stopping)
+    {
+        Task task;
+        if (pop(self, task) || steal(self, task))
+        {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock lock(sleepMutex);
+        wakeUp.wait(lock, [this]() { return stopping || queued > 0; });
+    }
+}
+
+bool Scheduler::pop(size_t self, Task & task)
+{
+    auto & worker = *workers[self];
+    std::lock_guard lock(worker.mutex);
+    if (worker.tasks.empty())
+    {
+        return false;
+    }
+
+    task = worker.tasks.back();
+    worker.tasks.pop_back();
+    --queued;
+    return true;
+}
+
+bool Scheduler::steal(size_t self, Task & task)
+{
+    for (size_t offset = 1; offset < workers.size(); ++offset)
+    {
+        auto & victim = *workers[(self + offset) % workers.size()];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            --queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Scheduler::execute(Task task)
+{
+    try
+    {
+        (*task.group->job)(task.index);
+    }
+    catch (...)
+    {
+        task.group->errors[task.index] = std::current_exception();
+    }
+
+    // the group can be gone as soon as it's decremented
+    if (--task.group->pending == 0)
+    {
+        std::lock_guard lock(sleepMutex);
+        wakeUp.notify_all();
+    }
+}
+
+}
+
+void set_jobs(unsigned count)
+{
+    scheduler.size = std::max(1u, count);
+}
+
+unsigned jobs()
+{
+    return scheduler.size;
+}
+
+void parallel_for(size_t count, const std::function<void(size_t)> & job)
+{
+    if (count <= 1 || jobs() <= 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            job(i);
+        }
+        return;
+    }
+
+    Group group { &job, count, std::vector<std::exception_ptr>(count) };
+    scheduler.run(group, count);
+
+    for (auto & error : group.errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
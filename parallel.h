@@ -0,0 +1,18 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+// Number of threads used by parallel_for(), must be set before its first call.
+// Defaults to the number of cores.
+void set_jobs(unsigned count);
+unsigned jobs();
+
+// Runs job(0) to job(count - 1) on a work-stealing pool and waits for all of them.
+// Jobs can call parallel_for() themselves, the waiting thread runs pending jobs
+// meanwhile. If some jobs throw, the exception of the lowest index is rethrown,
+// which is the one a sequential loop would have reported.
+void parallel_for(size_t count, const std::function<void(size_t)> & job);
+
+#endif // PARALLEL_H
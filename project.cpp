@@ -0,0 +1,241 @@
+#include "project.h"
+#include "parallel.h"
+#include "buildcache.h"
+#include "reachability.h"
+#include "staticinit.h"
+#include "boards/gamebuino.h"
+
+Project::Project(const std::vector<std::string> & javaFiles)
+{
+    std::set<std::string> sourcePaths;
+    for (auto & file : javaFiles)
+    {
+        sourcePaths.insert(ClassFile::classPath(file));
+    }
+
+    std::vector<std::string> classFiles;
+    for (const fs::directory_entry& dir_entry :
+            fs::recursive_directory_iterator("."))
+    {
+        if (dir_entry.is_regular_file() && dir_entry.path().extension().string() == ".class")
+        {
+            auto path = dir_entry.path().string();
+            if (!sourcePaths.contains(ClassFile::classPath(path)))
+            {
+                classFiles.push_back(path);
+            }
+        }
+    }
+
+    classes = parse(classFiles);
+    load(javaFiles);
+}
+
+// Parses the sources that aren't loaded yet and whose class file exists.
+void Project::load(const std::vector<std::string> & javaFiles)
+{
+    std::vector<std::string> missing;
+    for (auto & file : javaFiles)
+    {
+        auto path = ClassFile::classPath(file);
+        if (!findClass(path) && fs::exists(path + ".class"))
+        {
+            missing.push_back(file);
+        }
+    }
+
+    for (auto & source : parse(missing))
+    {
+        sources.push_back(std::move(source));
+    }
+
+    // same order as javaFiles, whatever was reloaded
+    std::unordered_map<std::string, size_t> order;
+    for (size_t i = 0; i < javaFiles.size(); ++i)
+    {
+        order[ClassFile::classPath(javaFiles[i])] = i;
+    }
+    std::stable_sort(sources.begin(), sources.end(), [&](auto & a, auto & b) {
+        return order[a.filePath] < order[b.filePath];
+    });
+
+    index();
+
+    name.clear();
+    board_name.clear();
+    profile_name.clear();
+    for (auto & source : sources)
+    {
+        if (source.hasBoard())
+        {
+            name = source.fileName;
+            board_name = source.boardName();
+            profile_name = source.profile_name;
+        }
+    }
+}
+
+Profile Project::profile() const
+{
+    auto & selected = profile_option.size() ? profile_option : profile_name;
+    return selected.size() ? getProfileFromString(selected) : Profile::Default;
+}
+
+// Drops these sources and unmaps their class files, which can then be rewritten.
+void Project::unload(const std::vector<std::string> & javaFiles)
+{
+    for (auto & file : javaFiles)
+    {
+        auto path = ClassFile::classPath(file);
+        std::erase_if(sources, [&](auto & source) { return source.filePath == path; });
+        ClassFile::unloadFile(path + ".class");
+    }
+
+    index();
+}
+
+// Must be called whenever sources or classes are resized or reordered.
+void Project::index()
+{
+    classIndex.clear();
+    for (auto & list : { &sources, &classes })
+    {
+        for (auto & c : *list)
+        {
+            classIndex.try_emplace(c.filePath, &c);
+        }
+    }
+}
+
+std::vector<ClassFile> Project::parse(const std::vector<std::string> & files)
+{
+    std::vector<std::optional<ClassFile>> parsed(files.size());
+    parallel_for(files.size(), [&](size_t i) {
+        parsed[i].emplace(files[i]);
+    });
+
+    std::vector<ClassFile> ret;
+    for (auto & c : parsed)
+    {
+        ret.push_back(std::move(*c));
+    }
+    return ret;
+}
+
+// Decompiles and generates the sources into the current directory.
+// Those whose class file and the signatures they depend on didn't change
+// since the previous run are skipped, their outputs are left untouched.
+void Project::generate(Board board)
+{
+    BuildCache cache(fs::current_path());
+    analyse(board);
+    auto projectSignature = signature();
+
+    std::vector<u8> keys(sources.size());
+    std::vector<const BuildCache::Entry *> cached(sources.size());
+    std::vector<std::vector<std::string>> outputs(sources.size());
+    parallel_for(sources.size(), [&](size_t i) {
+        auto & source = sources[i];
+        keys[i] = hashBytes(ClassFile::loadFile(source.filePath + ".class"),
+                            hashString(fmt::format("{} {}", std::to_underlying(board), projectSignature)));
+
+        cached[i] = cache.find(source.filePath, keys[i]);
+    });
+
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        // decompiled against a previous state of the project (watch mode)
+        if (!cached[i] && sources[i].project)
+        {
+            sources[i] = ClassFile(sources[i].filePath + ".class");
+        }
+    }
+    analyse(board);
+
+    parallel_for(sources.size(), [&](size_t i) {
+        if (!cached[i])
+        {
+            sources[i].decompile(*this);
+            outputs[i] = sources[i].generate(sources, board);
+        }
+    });
+
+    // the entries of the deleted sources are dropped, moving keeps "cached" valid
+    auto previous = std::move(cache.entries);
+    cache.entries.clear();
+    clear_resources();
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        if (cached[i])
+        {
+            cache.entries[sources[i].filePath] = *cached[i];
+        }
+        else
+        {
+            cache.store(sources[i].filePath, keys[i], outputs[i], sources[i].resources);
+        }
+
+        for (auto & res : cache.entries[sources[i].filePath].resources)
+        {
+            add_resource(res);
+        }
+    }
+    cache.save();
+}
+
+// Whole-program passes over the bytecode of the sources, run again on the
+// sources parsed anew since they only keep their results in the class.
+void Project::analyse(Board board)
+{
+    markReachable(sources, board);
+    markWrittenArrays();
+}
+
+// Flags the static arrays of the sources that are written after <clinit>,
+// the others are emitted as read-only data.
+void Project::markWrittenArrays()
+{
+    auto written = findWrittenArrays(sources);
+    for (auto & source : sources)
+    {
+        for (auto & field : source.fields)
+        {
+            field.written = field.isArray && written.contains({ source.filePath, field.name });
+        }
+    }
+}
+
+// Everything a source reads from the other classes while being generated,
+// any change in it invalidates the cached outputs of every source.
+u8 Project::signature() const
+{
+    u8 hash = hashString("");
+    for (auto & list : { &sources, &classes })
+    {
+        for (auto & c : *list)
+        {
+            hash = hashString(fmt::format("{} {} {}\n", c.filePath, c.fileName, c.board_name), hash);
+            for (auto & func : c.functions)
+            {
+                hash = hashString(fmt::format("{} {} {} {} {} {} {} {}\n", func.name, func.descriptor, func.flags,
+                                              func.returnFlags, fmt::join(func.parametersFlags, ","),
+                                              func.reachable, func.external, func.inlined), hash);
+            }
+            for (auto & field : c.fields)
+            {
+                // static final constants are folded where they are read,
+                // an array is only read-only if no source writes it
+                auto constant = c.fieldConstant(field.name);
+                hash = hashString(fmt::format("{} {} {} {} {}\n", field.name, field.type, field.flags,
+                                              constant ? getAsString(*constant) : "", field.written, field.reachable), hash);
+            }
+        }
+    }
+    return hash;
+}
+
+const ClassFile * Project::findClass(std::string_view path) const
+{
+    auto it = classIndex.find(path);
+    return (it != classIndex.end()) ? it->second : nullptr;
+}
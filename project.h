@@ -0,0 +1,38 @@
+#ifndef PROJECT_H
+#define PROJECT_H
+
+#include "classfile.h"
+#include "interner.h"
+
+// Every class of the tree, parsed once.
+// "sources" are the classes of the .java files in the current directory
+// and are the only ones being decompiled, the others are only used to know
+// the functions' signatures (API stubs, packages).
+class Project
+{
+public:
+    Project(const std::vector<std::string> & javaFiles);
+
+    void load(const std::vector<std::string> & javaFiles);
+    void unload(const std::vector<std::string> & javaFiles);
+    void generate(Board board);
+    void analyse(Board board);
+    void markWrittenArrays();
+    u8 signature() const;
+    Profile profile() const;
+    const ClassFile * findClass(std::string_view path) const;
+    void index();
+    static std::vector<ClassFile> parse(const std::vector<std::string> & files);
+
+    std::string name;
+    std::string board_name;
+    std::string profile_name; // @Profile of the board class
+    std::string profile_option; // --profile, wins over the annotation
+    std::string palette_option; // --palette, image of the colours of the Indexed images
+    Dither dither = Dither::None; // --dither, for the Indexed images
+    std::vector<ClassFile> sources;
+    std::vector<ClassFile> classes;
+    std::unordered_map<std::string, const ClassFile *, StringHash, std::equal_to<>> classIndex; // by path
+};
+
+#endif // PROJECT_H
@@ -0,0 +1,330 @@
+#include "reachability.h"
+#include "interner.h"
+#include <map>
+
+namespace
+{
+
+using MethodKey = std::tuple<std::string_view, std::string_view, std::string_view>; // class path, name, descriptor
+using FieldKey = std::pair<std::string_view, std::string_view>; // class path, name
+
+// bytes of bytecode of the methods emitted inline, like the default MaxInlineSize of HotSpot
+constexpr u4 MAX_INLINE_SIZE = 35;
+
+// the functions the runtime of the board calls
+std::vector<std::string_view> entryPoints(Board board)
+{
+    switch (board)
+    {
+    case Board::Gamebuino:
+        return { "setup", "loop" };
+    case Board::Picosystem:
+        return { "init", "update", "draw" };
+    default:
+        return { "main" };
+    }
+}
+
+class Reachability
+{
+public:
+    Reachability(std::vector<ClassFile> & sources);
+
+    void run(Board board);
+    MethodKey addMethod(std::string_view className, std::string_view name, std::string_view descriptor);
+    std::optional<MethodKey> addRef(const ClassFile & owner, u2 index, bool staticInit); // the method, if one
+    void addPool(const ClassFile & owner, bool staticInit);
+    void scan(const ClassFile & owner, const MethData & meth, const MethodKey & key);
+    bool isOtherClass(const ClassFile & owner, u1 opcode, u2 index) const;
+
+    std::vector<ClassFile> & sources;
+    std::unordered_map<std::string_view, const ClassFile *> byPath;
+    std::set<MethodKey> methods;
+    std::set<FieldKey> fields;
+    std::vector<MethodKey> pending;
+    std::set<MethodKey> external; // called by the runtime or by user code
+    std::set<MethodKey> recursive; // calls itself
+    std::set<MethodKey> crossing; // uses another class of the project, or unknown code
+    std::map<MethodKey, u4> sizes; // bytes of bytecode
+};
+
+Reachability::Reachability(std::vector<ClassFile> & sources)
+    : sources(sources)
+{
+    for (auto & source : sources)
+    {
+        byPath[source.filePath] = &source;
+    }
+}
+
+MethodKey Reachability::addMethod(std::string_view className, std::string_view name, std::string_view descriptor)
+{
+    MethodKey key { intern(className), intern(name), intern(descriptor) };
+    if (methods.insert(key).second)
+    {
+        pending.push_back(key);
+    }
+    return key;
+}
+
+// Methodref or Fieldref, the fields <clinit> initialises aren't used by it
+std::optional<MethodKey> Reachability::addRef(const ClassFile & owner, u2 index, bool staticInit)
+{
+    u2 classIndex, natIndex;
+    bool isField = false;
+    if (auto field = std::get_if<Fieldref>(&owner.constantPool[index]))
+    {
+        classIndex = field->class_index;
+        natIndex = field->name_and_type_index;
+        isField = true;
+    }
+    else if (auto method = std::get_if<Methodref>(&owner.constantPool[index]))
+    {
+        classIndex = method->class_index;
+        natIndex = method->name_and_type_index;
+    }
+    else
+    {
+        return {};
+    }
+
+    auto & nat = std::get<NameAndType>(owner.constantPool[natIndex]);
+    auto className = owner.getStringFromUtf8(std::get<Class>(owner.constantPool[classIndex]).name_index);
+    auto name = owner.getStringFromUtf8(nat.name_index);
+
+    if (!isField)
+    {
+        return addMethod(className, name, owner.getStringFromUtf8(nat.descriptor_index));
+    }
+
+    if (!staticInit || className != owner.filePath)
+    {
+        fields.emplace(intern(className), intern(name));
+    }
+    return {};
+}
+
+// when the code can't be walked, everything the class refers to is used
+void Reachability::addPool(const ClassFile & owner, bool staticInit)
+{
+    for (size_t i = 0; i < owner.constantPool.size(); ++i)
+    {
+        addRef(owner, static_cast<u2>(i), staticInit);
+    }
+}
+
+// the headers of the project include each other, a class body only sees its own class
+bool Reachability::isOtherClass(const ClassFile & owner, u1 opcode, u2 index) const
+{
+    u2 classIndex = index;
+    if (opcode >= getstatic && opcode <= invokestatic)
+    {
+        if (auto field = std::get_if<Fieldref>(&owner.constantPool[index]))
+        {
+            classIndex = field->class_index;
+        }
+        else if (auto method = std::get_if<Methodref>(&owner.constantPool[index]))
+        {
+            classIndex = method->class_index;
+        }
+        else
+        {
+            return true;
+        }
+    }
+
+    auto className = owner.getStringFromUtf8(std::get<Class>(owner.constantPool[classIndex]).name_index);
+    auto element = className.find_first_not_of('[');
+    if (element > 0 && element < className.size() && className[element] == 'L')
+    {
+        className = className.substr(element + 1, className.size() - element - 2);
+    }
+    return className != owner.filePath && byPath.contains(className);
+}
+
+// bytes taken by an instruction, none when its length depends on its operands
+std::optional<size_t> instructionLength(u1 opcode)
+{
+    if (opcode == bipush || opcode == ldc || opcode == newarray
+        || (opcode >= iload && opcode <= aload) || (opcode >= istore && opcode <= astore)
+        || opcode == 0xa9) // ret
+    {
+        return 2;
+    }
+    if (opcode == sipush || opcode == ldc_w || opcode == ldc2_w || opcode == iinc
+        || (opcode >= ifeq && opcode <= 0xa8) // up to jsr
+        || (opcode >= getstatic && opcode <= invokestatic)
+        || opcode == new_ || opcode == anewarray
+        || opcode == 0xc0 || opcode == 0xc1 // checkcast, instanceof
+        || opcode == 0xc6 || opcode == 0xc7) // ifnull, ifnonnull
+    {
+        return 3;
+    }
+    if (opcode == 0xc5) // multianewarray
+    {
+        return 4;
+    }
+    if (opcode == 0xb9 || opcode == invokedynamic || opcode == 0xc8 || opcode == 0xc9) // invokeinterface, goto_w, jsr_w
+    {
+        return 5;
+    }
+    if (opcode == 0xaa || opcode == lookupswitch || opcode == 0xc4 || opcode > 0xc9) // tableswitch, wide
+    {
+        return {};
+    }
+    return 1;
+}
+
+void Reachability::scan(const ClassFile & owner, const MethData & meth, const MethodKey & key)
+{
+    bool staticInit = meth.name == STATIC_INIT;
+    try
+    {
+        Reader buffer(meth.buffer);
+        if (!buffer.size())
+        {
+            return;
+        }
+
+        [[maybe_unused]] u2 max_stack = r16();
+        [[maybe_unused]] u2 max_locals = r16();
+        u4 code_length = r32();
+        auto code = buffer.view(code_length);
+        sizes[key] = code_length;
+
+        for (size_t pc = 0; pc < code.size();)
+        {
+            auto opcode = code[pc];
+            auto length = instructionLength(opcode);
+            if (!length || pc + *length > code.size())
+            {
+                throw fmt::format("Opcode '{:x}' isn't scanned.", opcode);
+            }
+
+            auto operand = (*length >= 3) ? static_cast<u2>(code[pc + 1] << 8 | code[pc + 2]) : u2 { 0 };
+            if (opcode == 0xb9 || opcode == invokedynamic) // invokeinterface
+            {
+                crossing.insert(key);
+            }
+            else if (((opcode >= getstatic && opcode <= invokestatic) || opcode == new_ || opcode == anewarray
+                      || opcode == 0xc0 || opcode == 0xc1 || opcode == 0xc5) // checkcast, instanceof, multianewarray
+                     && isOtherClass(owner, opcode, operand))
+            {
+                crossing.insert(key);
+            }
+
+            // invokedynamic is left out, the callbacks are roots
+            if (opcode >= getstatic && opcode <= invokestatic)
+            {
+                auto target = addRef(owner, operand, staticInit);
+                if (target == key)
+                {
+                    recursive.insert(key);
+                }
+                else if (target && std::get<0>(*target) != owner.filePath)
+                {
+                    external.insert(*target);
+                }
+            }
+            pc += *length;
+        }
+    }
+    catch (const std::string &)
+    {
+        crossing.insert(key);
+        addPool(owner, staticInit);
+    }
+}
+
+void Reachability::run(Board board)
+{
+    auto entries = entryPoints(board);
+    for (auto & source : sources)
+    {
+        for (auto & meth : source.methodsToDecompile)
+        {
+            auto isEntry = source.hasBoard() && std::ranges::find(entries, meth.name) != entries.end();
+            auto isPublic = source.hasBoard() && (meth.access & ACC_PUBLIC);
+            if (meth.name == STATIC_INIT)
+            {
+                addMethod(source.filePath, meth.name, meth.descriptor);
+            }
+            else if (isEntry || isPublic)
+            {
+                external.insert(addMethod(source.filePath, meth.name, meth.descriptor));
+            }
+        }
+
+        if (source.hasBoard())
+        {
+            for (auto & field : source.fields)
+            {
+                if (field.flags & ACC_PUBLIC)
+                {
+                    fields.emplace(intern(source.filePath), field.name);
+                }
+            }
+        }
+
+        // method references given to invokedynamic, as callbacks
+        for (auto & constant : source.constantPool)
+        {
+            if (auto handle = std::get_if<MethodHandle>(&constant))
+            {
+                addRef(source, handle->reference_index, false);
+            }
+        }
+    }
+
+    while (!pending.empty())
+    {
+        auto key = pending.back();
+        auto [className, name, descriptor] = key;
+        pending.pop_back();
+
+        auto it = byPath.find(className);
+        if (it == byPath.end())
+        {
+            continue; // stubs
+        }
+
+        for (auto & meth : it->second->methodsToDecompile)
+        {
+            if (meth.name == name && meth.descriptor == descriptor)
+            {
+                scan(*it->second, meth, key);
+            }
+        }
+    }
+}
+
+}
+
+void markReachable(std::vector<ClassFile> & sources, Board board)
+{
+    Reachability reachability(sources);
+    reachability.run(board);
+
+    for (auto & source : sources)
+    {
+        auto path = intern(source.filePath);
+        for (auto & func : source.functions)
+        {
+            MethodKey key { path, func.name, func.descriptor };
+            auto size = reachability.sizes.find(key);
+            auto isShort = size != reachability.sizes.end() && size->second <= MAX_INLINE_SIZE
+                        && !reachability.recursive.contains(key);
+
+            func.reachable = reachability.methods.contains(key);
+            func.external = !source.hasBoard() || reachability.external.contains(key);
+
+            // board functions are static inline, members are defined in their class body
+            func.inlined = func.reachable && isShort
+                        && (source.hasBoard() ? !func.external : !reachability.crossing.contains(key));
+        }
+        for (auto & field : source.fields)
+        {
+            field.reachable = reachability.fields.contains({ path, field.name });
+        }
+    }
+}
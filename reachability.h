@@ -0,0 +1,15 @@
+#ifndef REACHABILITY_H
+#define REACHABILITY_H
+
+#include "classfile.h"
+
+// Flags the methods and fields of the sources that can be reached from the
+// board entry points, through the calls and field accesses of the bytecode.
+// The board class's public members (declared in its header for user code),
+// every <clinit> and the methods given as callbacks are roots too.
+// The others aren't decompiled nor emitted.
+// The board methods only the generated code calls are told apart, with
+// the short ones that don't call themselves, to get internal linkage.
+void markReachable(std::vector<ClassFile> & sources, Board board);
+
+#endif // REACHABILITY_H
@@ -0,0 +1,1180 @@
+#include "staticinit.h"
+#include "project.h"
+
+namespace
+{
+
+struct Unknown {};
+struct ArrayRef { size_t id; };
+
+// strings are kept as C++ literals
+using Slot = std::variant<Unknown, int32_t, int64_t, float, double, std::string, ArrayRef>;
+
+struct HeapArray
+{
+    int type; // T_* of the elements
+    std::vector<Slot> elements;
+    bool escaped = false; // given to a method or stored somewhere unknown
+};
+
+// <clinit> loops are short, this only stops the runaway ones
+constexpr size_t MAX_STEPS = 1'000'000;
+constexpr int32_t MAX_ARRAY_SIZE = 65536;
+
+class StaticInterpreter
+{
+public:
+    StaticInterpreter(const ClassFile & owner, std::span<const u1> code)
+        : owner(owner), code(code) {}
+
+    void run();
+    std::optional<std::string> render(const Slot & slot) const;
+
+    u1 readU1() { return at(pc++); }
+    s2 readS2() { s2 v = at(pc) << 8 | at(pc + 1); pc += 2; return v; }
+    u2 readU2() { return static_cast<u2>(readS2()); }
+    u1 at(size_t index) const;
+
+    Slot popValue();
+    int32_t popInt(); // throws when unknown, for sizes and branches
+    void branch(size_t start, bool taken);
+    void escape(const Slot & slot);
+    Slot defaultValue(int type) const;
+    Slot getStatic(const ResolvedFieldRef & field) const;
+
+    const ClassFile & owner;
+    std::span<const u1> code;
+    size_t pc = 0;
+    std::vector<Slot> stack;
+    std::unordered_map<int, Slot> locals;
+    std::vector<HeapArray> heap;
+    std::unordered_map<std::string_view, Slot> statics; // fields of the class assigned so far
+};
+
+u1 StaticInterpreter::at(size_t index) const
+{
+    if (index >= code.size())
+    {
+        throw fmt::format("Running past the end of <clinit>.");
+    }
+    return code[index];
+}
+
+Slot StaticInterpreter::popValue()
+{
+    if (stack.empty())
+    {
+        throw fmt::format("Empty stack in <clinit>.");
+    }
+    auto value = stack.back();
+    stack.pop_back();
+    return value;
+}
+
+int32_t StaticInterpreter::popInt()
+{
+    auto value = popValue();
+    if (auto i = std::get_if<int32_t>(&value))
+    {
+        return *i;
+    }
+    throw fmt::format("<clinit> depends on an unknown value.");
+}
+
+void StaticInterpreter::branch(size_t start, bool taken)
+{
+    auto offset = readS2();
+    if (taken)
+    {
+        pc = start + offset;
+    }
+}
+
+void StaticInterpreter::escape(const Slot & slot)
+{
+    if (auto arr = std::get_if<ArrayRef>(&slot))
+    {
+        heap[arr->id].escaped = true;
+    }
+}
+
+Slot StaticInterpreter::defaultValue(int type) const
+{
+    switch (type)
+    {
+    case T_BOOLEAN:
+    case T_CHAR:
+    case T_BYTE:
+    case T_SHORT:
+    case T_INT:    return int32_t { 0 };
+    case T_LONG:   return int64_t { 0 };
+    case T_FLOAT:  return 0.0f;
+    case T_DOUBLE: return 0.0;
+    }
+    return Unknown {}; // null
+}
+
+Slot StaticInterpreter::getStatic(const ResolvedFieldRef & field) const
+{
+    auto c = owner.project->findClass(field.className);
+    if (c == &owner)
+    {
+        auto it = statics.find(field.name);
+        if (it != statics.end())
+        {
+            return it->second;
+        }
+    }
+
+    if (auto constant = c ? c->fieldConstant(field.name) : std::nullopt)
+    {
+        return std::visit([](auto && arg) -> Slot {
+            using T = std::decay_t<decltype(arg)>;
+            if constexpr (std::is_arithmetic_v<T>)
+            {
+                return arg;
+            }
+            else
+            {
+                return Unknown {};
+            }
+        }, *constant);
+    }
+
+    if (c != &owner)
+    {
+        return Unknown {};
+    }
+
+    // not assigned yet, the JVM default
+    switch (field.descriptor[0])
+    {
+    case 'Z': return defaultValue(T_BOOLEAN);
+    case 'C': return defaultValue(T_CHAR);
+    case 'B': return defaultValue(T_BYTE);
+    case 'S': return defaultValue(T_SHORT);
+    case 'I': return defaultValue(T_INT);
+    case 'J': return defaultValue(T_LONG);
+    case 'F': return defaultValue(T_FLOAT);
+    case 'D': return defaultValue(T_DOUBLE);
+    }
+    return Unknown {};
+}
+
+// the value a store to an array of this type keeps
+static Slot narrow(int type, const Slot & value)
+{
+    auto i = std::get_if<int32_t>(&value);
+    if (!i)
+    {
+        return value;
+    }
+
+    switch (type)
+    {
+    case T_BOOLEAN: return int32_t { *i & 1 };
+    case T_CHAR:    return int32_t { static_cast<uint16_t>(*i) };
+    case T_BYTE:    return int32_t { static_cast<int8_t>(*i) };
+    case T_SHORT:   return int32_t { static_cast<int16_t>(*i) };
+    }
+    return value;
+}
+
+// Java arithmetic, unknown when an operand is
+template<typename T, typename F>
+static Slot compute(const Slot & left, const Slot & right, F f)
+{
+    auto l = std::get_if<T>(&left);
+    auto r = std::get_if<T>(&right);
+    if (!l || !r)
+    {
+        return Unknown {};
+    }
+    return f(*l, *r);
+}
+
+template<typename T>
+static T wrap(std::make_unsigned_t<T> value)
+{
+    return static_cast<T>(value);
+}
+
+void StaticInterpreter::run()
+{
+    using U = uint32_t;
+
+    size_t steps = 0;
+    while (true)
+    {
+        if (++steps > MAX_STEPS)
+        {
+            throw fmt::format("<clinit> runs for too long.");
+        }
+
+        auto start = pc;
+        auto opcode = readU1();
+
+        switch (opcode)
+        {
+        case aconst_null:
+            stack.push_back(Unknown {});
+            break;
+        case iconst_m1:
+        case iconst_0:
+        case iconst_1:
+        case iconst_2:
+        case iconst_3:
+        case iconst_4:
+        case iconst_5:
+            stack.push_back(int32_t { opcode - iconst_0 });
+            break;
+        case fconst_0:
+        case fconst_1:
+        case fconst_2:
+            stack.push_back(static_cast<float>(opcode - fconst_0));
+            break;
+        case bipush:
+            stack.push_back(int32_t { static_cast<s1>(readU1()) });
+            break;
+        case sipush:
+            stack.push_back(int32_t { readS2() });
+            break;
+        case ldc:
+        case ldc_w:
+        case ldc2_w:
+        {
+            auto index = (opcode == ldc) ? readU1() : readU2();
+            auto & constant = owner.constantPool[index];
+            if (auto str = std::get_if<String>(&constant))
+            {
+                stack.push_back(fmt::format("\"{}\"", owner.getStringFromUtf8(str->string_index)));
+            }
+            else if (auto i = std::get_if<s4>(&constant))
+            {
+                stack.push_back(*i);
+            }
+            else if (auto l = std::get_if<s8>(&constant))
+            {
+                stack.push_back(*l);
+            }
+            else if (auto f = std::get_if<float>(&constant))
+            {
+                stack.push_back(*f);
+            }
+            else if (auto d = std::get_if<double>(&constant))
+            {
+                stack.push_back(*d);
+            }
+            else
+            {
+                stack.push_back(Unknown {});
+            }
+            break;
+        }
+        case iload:
+        case lload:
+        case fload:
+        case dload:
+        case aload:
+        case iload_0:
+        case iload_1:
+        case iload_2:
+        case iload_3:
+        case lload_0:
+        case lload_1:
+        case lload_2:
+        case lload_3:
+        case fload_0:
+        case fload_1:
+        case fload_2:
+        case fload_3:
+        case dload_0:
+        case dload_1:
+        case dload_2:
+        case dload_3:
+        case aload_0:
+        case aload_1:
+        case aload_2:
+        case aload_3:
+        {
+            int index;
+            if (opcode <= aload)
+            {
+                index = readU1();
+            }
+            else
+            {
+                // iload_0 to aload_3 are four by four
+                index = (opcode - iload_0) % 4;
+            }
+
+            auto it = locals.find(index);
+            if (it == locals.end())
+            {
+                throw fmt::format("Local {} read before being written in <clinit>.", index);
+            }
+            stack.push_back(it->second);
+            break;
+        }
+        case istore:
+        case lstore:
+        case fstore:
+        case dstore:
+        case astore:
+            locals[readU1()] = popValue();
+            break;
+        case istore_0:
+        case istore_1:
+        case istore_2:
+        case istore_3:
+            locals[opcode - istore_0] = popValue();
+            break;
+        case lstore_0:
+        case lstore_1:
+        case lstore_2:
+        case lstore_3:
+            locals[opcode - lstore_0] = popValue();
+            break;
+        case fstore_0:
+        case fstore_1:
+        case fstore_2:
+        case fstore_3:
+            locals[opcode - fstore_0] = popValue();
+            break;
+        case dstore_0:
+        case dstore_1:
+        case dstore_2:
+        case dstore_3:
+            locals[opcode - dstore_0] = popValue();
+            break;
+        case astore_0:
+        case astore_1:
+        case astore_2:
+        case astore_3:
+            locals[opcode - astore_0] = popValue();
+            break;
+        case iaload:
+        case laload:
+        case faload:
+        case daload:
+        case aaload:
+        case baload:
+        case caload:
+        case saload:
+        {
+            auto index = popValue();
+            auto arr = popValue();
+            auto ref = std::get_if<ArrayRef>(&arr);
+            auto i = std::get_if<int32_t>(&index);
+            if (!ref || !i || heap[ref->id].escaped)
+            {
+                stack.push_back(Unknown {});
+                break;
+            }
+
+            auto & elements = heap[ref->id].elements;
+            if (*i < 0 || *i >= static_cast<int32_t>(elements.size()))
+            {
+                throw fmt::format("Array index out of bounds in <clinit>.");
+            }
+            stack.push_back(elements[*i]);
+            break;
+        }
+        case iastore:
+        case lastore:
+        case fastore:
+        case dastore:
+        case aastore:
+        case bastore:
+        case castore:
+        case sastore:
+        {
+            auto value = popValue();
+            auto index = popValue();
+            auto arr = popValue();
+            escape(value);
+
+            auto ref = std::get_if<ArrayRef>(&arr);
+            if (!ref)
+            {
+                break;
+            }
+
+            auto & array = heap[ref->id];
+            auto i = std::get_if<int32_t>(&index);
+            if (!i)
+            {
+                array.escaped = true;
+                break;
+            }
+            if (*i < 0 || *i >= static_cast<int32_t>(array.elements.size()))
+            {
+                throw fmt::format("Array index out of bounds in <clinit>.");
+            }
+            array.elements[*i] = narrow(array.type, value);
+            break;
+        }
+        case pop:
+            popValue();
+            break;
+        case dup_:
+        {
+            auto value = popValue();
+            stack.push_back(value);
+            stack.push_back(value);
+            break;
+        }
+        case iadd:
+        case isub:
+        case imul:
+        case iand:
+        case ishl:
+        {
+            auto right = popValue();
+            auto left = popValue();
+            stack.push_back(compute<int32_t>(left, right, [&](int32_t l, int32_t r) {
+                switch (opcode)
+                {
+                case iadd: return wrap<int32_t>(U(l) + U(r));
+                case isub: return wrap<int32_t>(U(l) - U(r));
+                case imul: return wrap<int32_t>(U(l) * U(r));
+                case iand: return l & r;
+                default:   return wrap<int32_t>(U(l) << (r & 31));
+                }
+            }));
+            break;
+        }
+        case idiv:
+        case irem:
+        {
+            auto right = popValue();
+            auto left = popValue();
+            if (std::get_if<int32_t>(&right) && std::get<int32_t>(right) == 0)
+            {
+                throw fmt::format("Division by zero in <clinit>.");
+            }
+            stack.push_back(compute<int32_t>(left, right, [&](int32_t l, int32_t r) {
+                if (l == std::numeric_limits<int32_t>::min() && r == -1)
+                {
+                    return (opcode == idiv) ? l : 0;
+                }
+                return (opcode == idiv) ? l / r : l % r;
+            }));
+            break;
+        }
+        case ineg:
+        {
+            auto value = popValue();
+            auto i = std::get_if<int32_t>(&value);
+            stack.push_back(i ? Slot { wrap<int32_t>(0 - U(*i)) } : Slot { Unknown {} });
+            break;
+        }
+        case ladd:
+        case lmul:
+        {
+            auto right = popValue();
+            auto left = popValue();
+            stack.push_back(compute<int64_t>(left, right, [&](int64_t l, int64_t r) {
+                using U8 = uint64_t;
+                return (opcode == ladd) ? wrap<int64_t>(U8(l) + U8(r)) : wrap<int64_t>(U8(l) * U8(r));
+            }));
+            break;
+        }
+        case fadd_:
+        case fmul_:
+        {
+            auto right = popValue();
+            auto left = popValue();
+            stack.push_back(compute<float>(left, right, [&](float l, float r) {
+                return (opcode == fadd_) ? l + r : l * r;
+            }));
+            break;
+        }
+        case dadd:
+        case dmul:
+        {
+            auto right = popValue();
+            auto left = popValue();
+            stack.push_back(compute<double>(left, right, [&](double l, double r) {
+                return (opcode == dadd) ? l + r : l * r;
+            }));
+            break;
+        }
+        case iinc:
+        {
+            auto index = readU1();
+            auto constant = static_cast<s1>(readU1());
+            auto it = locals.find(index);
+            if (it == locals.end() || !std::holds_alternative<int32_t>(it->second))
+            {
+                throw fmt::format("<clinit> depends on an unknown value.");
+            }
+            it->second = wrap<int32_t>(U(std::get<int32_t>(it->second)) + U(constant));
+            break;
+        }
+        case i2f:
+        case i2d:
+        case l2f:
+        case f2i:
+        case f2d:
+        case d2i:
+        {
+            auto value = popValue();
+            Slot result = Unknown {};
+            if (auto i = std::get_if<int32_t>(&value))
+            {
+                result = (opcode == i2f) ? Slot { static_cast<float>(*i) } : Slot { static_cast<double>(*i) };
+            }
+            else if (auto l = std::get_if<int64_t>(&value))
+            {
+                result = static_cast<float>(*l);
+            }
+            else if (auto f = std::get_if<float>(&value))
+            {
+                result = (opcode == f2i) ? Slot { javaToInt(*f) } : Slot { static_cast<double>(*f) };
+            }
+            else if (auto d = std::get_if<double>(&value))
+            {
+                result = javaToInt(*d);
+            }
+            stack.push_back(result);
+            break;
+        }
+        case ifeq:
+        case ifne:
+        case iflt:
+        case ifge:
+        case ifgt:
+        case ifle:
+        {
+            auto value = popInt();
+            bool taken = false;
+            switch (opcode)
+            {
+            case ifeq: taken = value == 0; break;
+            case ifne: taken = value != 0; break;
+            case iflt: taken = value <  0; break;
+            case ifge: taken = value >= 0; break;
+            case ifgt: taken = value >  0; break;
+            case ifle: taken = value <= 0; break;
+            }
+            branch(start, taken);
+            break;
+        }
+        case if_icmpeq:
+        case if_icmpne:
+        case if_icmplt:
+        case if_icmpge:
+        case if_icmpgt:
+        case if_icmple:
+        {
+            auto right = popInt();
+            auto left = popInt();
+            bool taken = false;
+            switch (opcode)
+            {
+            case if_icmpeq: taken = left == right; break;
+            case if_icmpne: taken = left != right; break;
+            case if_icmplt: taken = left <  right; break;
+            case if_icmpge: taken = left >= right; break;
+            case if_icmpgt: taken = left >  right; break;
+            case if_icmple: taken = left <= right; break;
+            }
+            branch(start, taken);
+            break;
+        }
+        case goto_:
+            branch(start, true);
+            break;
+        case return_:
+            return;
+        case getstatic:
+        {
+            auto & field = std::get<ResolvedFieldRef>(owner.resolvedPool[readU2()]);
+            stack.push_back(getStatic(field));
+            break;
+        }
+        case putstatic:
+        {
+            auto & field = std::get<ResolvedFieldRef>(owner.resolvedPool[readU2()]);
+            auto value = popValue();
+            if (owner.project->findClass(field.className) == &owner)
+            {
+                statics[field.name] = value;
+            }
+            else
+            {
+                escape(value);
+            }
+            break;
+        }
+        case getfield:
+            readU2();
+            popValue();
+            stack.push_back(Unknown {});
+            break;
+        case putfield:
+            readU2();
+            escape(popValue());
+            popValue();
+            break;
+        case invokestatic:
+        case invokevirtual:
+        case invokespecial:
+        {
+            auto & method = std::get<ResolvedMethodRef>(owner.resolvedPool[readU2()]);
+            auto argsCount = method.args() + (opcode == invokestatic ? 0 : 1);
+            for (u4 i = 0; i < argsCount; ++i)
+            {
+                escape(popValue());
+            }
+
+            if (method.returnType.size() && method.returnType != "void")
+            {
+                stack.push_back(Unknown {});
+            }
+            break;
+        }
+        case new_:
+            readU2();
+            stack.push_back(Unknown {});
+            break;
+        case newarray:
+        case anewarray:
+        {
+            auto size = popInt();
+            int type = T_OBJECT;
+            if (opcode == newarray)
+            {
+                type = readU1();
+            }
+            else
+            {
+                auto & c = std::get<Class>(owner.constantPool[readU2()]);
+                if (owner.getStringFromUtf8(c.name_index) == "java/lang/String")
+                {
+                    type = T_STRING;
+                }
+            }
+
+            if (size < 0 || size > MAX_ARRAY_SIZE)
+            {
+                throw fmt::format("Array size {} in <clinit>.", size);
+            }
+
+            heap.push_back({ type, std::vector<Slot>(size, defaultValue(type)) });
+            stack.push_back(ArrayRef { heap.size() - 1 });
+            break;
+        }
+        case arraylength:
+        {
+            auto arr = popValue();
+            auto ref = std::get_if<ArrayRef>(&arr);
+            stack.push_back(ref ? Slot { static_cast<int32_t>(heap[ref->id].elements.size()) } : Slot { Unknown {} });
+            break;
+        }
+        default:
+            throw fmt::format("Opcode '{:x}' isn't evaluated in <clinit>.", opcode);
+        }
+    }
+}
+
+std::optional<std::string> StaticInterpreter::render(const Slot & slot) const
+{
+    return std::visit([&](auto && arg) -> std::optional<std::string> {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, Unknown>)
+        {
+            return {};
+        }
+        else if constexpr (std::is_same_v<T, std::string>)
+        {
+            return arg;
+        }
+        else if constexpr (std::is_same_v<T, ArrayRef>)
+        {
+            auto & array = heap[arg.id];
+            if (array.escaped || array.elements.empty())
+            {
+                return {};
+            }
+
+            std::string output;
+            for (auto & element : array.elements)
+            {
+                if (std::holds_alternative<ArrayRef>(element))
+                {
+                    return {};
+                }
+                auto value = render(element);
+                if (!value)
+                {
+                    return {};
+                }
+                output += (output.empty() ? "" : ", ") + *value;
+            }
+            return fmt::format("{{ {} }}", output);
+        }
+        else
+        {
+            return getAsString(arg);
+        }
+    }, slot);
+}
+
+}
+
+std::vector<StaticInit> evaluateStaticInit(const ClassFile & owner, std::span<const u1> code)
+{
+    StaticInterpreter interpreter(owner, code);
+    try
+    {
+        interpreter.run();
+    }
+    catch (const std::string &)
+    {
+        // left to the decompiled <clinit>
+        return {};
+    }
+
+    // an array in two fields would be copied in each, its identity is lost
+    std::unordered_map<size_t, int> arrayUses;
+    for (auto & [name, value] : interpreter.statics)
+    {
+        if (auto ref = std::get_if<ArrayRef>(&value))
+        {
+            ++arrayUses[ref->id];
+        }
+    }
+
+    std::vector<StaticInit> inits;
+    for (auto & [name, value] : interpreter.statics)
+    {
+        auto ref = std::get_if<ArrayRef>(&value);
+        if (ref && arrayUses[ref->id] > 1)
+        {
+            continue;
+        }
+
+        if (auto init = interpreter.render(value))
+        {
+            bool constant = !std::holds_alternative<std::string>(value)
+                         && !(ref && interpreter.heap[ref->id].type == T_STRING);
+            inits.push_back({ name, *init, constant });
+        }
+    }
+
+    // same order on every run
+    std::sort(inits.begin(), inits.end(), [](auto & a, auto & b) { return a.field < b.field; });
+    return inits;
+}
+
+namespace
+{
+
+// the static array fields a value on the operand stack or in a local may be
+using Tags = std::set<FieldKey>;
+
+FieldKey fieldKey(const ClassFile & owner, const Fieldref & field)
+{
+    auto & nat = std::get<NameAndType>(owner.constantPool[field.name_and_type_index]);
+    auto & c = std::get<Class>(owner.constantPool[field.class_index]);
+    return { intern(owner.getStringFromUtf8(c.name_index)), intern(owner.getStringFromUtf8(nat.name_index)) };
+}
+
+class ArrayWriteScan
+{
+public:
+    ArrayWriteScan(const ClassFile & owner, std::span<const u1> code, bool staticInit, std::set<FieldKey> & written)
+        : owner(owner), code(code), staticInit(staticInit), written(written) {}
+
+    void run();
+
+    u1 readU1() { return at(pc++); }
+    u2 readU2() { u2 v = at(pc) << 8 | at(pc + 1); pc += 2; return v; }
+    u1 at(size_t index) const;
+
+    Tags popTags();
+    void popValues(size_t count, bool escape);
+    void write(const Tags & tags); // elements stored or reference lost
+    std::string_view descriptor(u2 nameAndTypeIndex) const;
+
+    const ClassFile & owner;
+    std::span<const u1> code;
+    bool staticInit; // stores into the fields of the class are their initialisation
+    std::set<FieldKey> & written;
+    size_t pc = 0;
+    std::vector<Tags> stack;
+    std::unordered_map<int, Tags> locals; // never cleared, whatever the branches
+};
+
+u1 ArrayWriteScan::at(size_t index) const
+{
+    if (index >= code.size())
+    {
+        throw fmt::format("Running past the end of the code.");
+    }
+    return code[index];
+}
+
+Tags ArrayWriteScan::popTags()
+{
+    if (stack.empty())
+    {
+        throw fmt::format("Empty stack.");
+    }
+    auto tags = std::move(stack.back());
+    stack.pop_back();
+    return tags;
+}
+
+void ArrayWriteScan::popValues(size_t count, bool escape)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto tags = popTags();
+        if (escape)
+        {
+            write(tags);
+        }
+    }
+}
+
+void ArrayWriteScan::write(const Tags & tags)
+{
+    written.insert(tags.begin(), tags.end());
+}
+
+std::string_view ArrayWriteScan::descriptor(u2 nameAndTypeIndex) const
+{
+    auto & nat = std::get<NameAndType>(owner.constantPool[nameAndTypeIndex]);
+    return owner.getStringFromUtf8(nat.descriptor_index);
+}
+
+// Follows the array references in straight-line code, as javac emits a
+// statement: a branch or a jump with something on the stack stops the scan.
+void ArrayWriteScan::run()
+{
+    while (pc < code.size())
+    {
+        auto opcode = readU1();
+
+        switch (opcode)
+        {
+        case aconst_null:
+        case iconst_m1:
+        case iconst_0:
+        case iconst_1:
+        case iconst_2:
+        case iconst_3:
+        case iconst_4:
+        case iconst_5:
+        case fconst_0:
+        case fconst_1:
+        case fconst_2:
+            stack.emplace_back();
+            break;
+        case bipush:
+        case ldc:
+            readU1();
+            stack.emplace_back();
+            break;
+        case sipush:
+        case ldc_w:
+        case ldc2_w:
+            readU2();
+            stack.emplace_back();
+            break;
+        case iload:
+        case lload:
+        case fload:
+        case dload:
+        case iload_0:
+        case iload_1:
+        case iload_2:
+        case iload_3:
+        case lload_0:
+        case lload_1:
+        case lload_2:
+        case lload_3:
+        case fload_0:
+        case fload_1:
+        case fload_2:
+        case fload_3:
+        case dload_0:
+        case dload_1:
+        case dload_2:
+        case dload_3:
+            if (opcode <= dload)
+            {
+                readU1();
+            }
+            stack.emplace_back();
+            break;
+        case aload:
+        case aload_0:
+        case aload_1:
+        case aload_2:
+        case aload_3:
+        {
+            int index = (opcode == aload) ? readU1() : opcode - aload_0;
+            stack.push_back(locals[index]);
+            break;
+        }
+        case istore:
+        case lstore:
+        case fstore:
+        case dstore:
+            readU1();
+            popTags();
+            break;
+        case astore:
+        case astore_0:
+        case astore_1:
+        case astore_2:
+        case astore_3:
+        {
+            // a local alias is followed like the field itself
+            int index = (opcode == astore) ? readU1() : opcode - astore_0;
+            auto tags = popTags();
+            locals[index].insert(tags.begin(), tags.end());
+            break;
+        }
+        case istore_0:
+        case istore_1:
+        case istore_2:
+        case istore_3:
+        case lstore_0:
+        case lstore_1:
+        case lstore_2:
+        case lstore_3:
+        case fstore_0:
+        case fstore_1:
+        case fstore_2:
+        case fstore_3:
+        case dstore_0:
+        case dstore_1:
+        case dstore_2:
+        case dstore_3:
+        case pop:
+            popTags();
+            break;
+        case iaload:
+        case laload:
+        case faload:
+        case daload:
+        case aaload:
+        case baload:
+        case caload:
+        case saload:
+            popValues(2, false);
+            stack.emplace_back();
+            break;
+        case iastore:
+        case lastore:
+        case fastore:
+        case dastore:
+        case aastore:
+        case bastore:
+        case castore:
+        case sastore:
+        {
+            popValues(2, true); // value, an array stored in another one is lost
+            auto tags = popTags();
+            if (staticInit)
+            {
+                std::erase_if(tags, [&](auto & key) { return key.first == owner.filePath; });
+            }
+            write(tags);
+            break;
+        }
+        case dup_:
+            stack.push_back(popTags());
+            stack.push_back(stack.back());
+            break;
+        case iadd:
+        case ladd:
+        case fadd_:
+        case dadd:
+        case isub:
+        case imul:
+        case lmul:
+        case fmul_:
+        case dmul:
+        case idiv:
+        case irem:
+        case ishl:
+        case iand:
+            popValues(2, false);
+            stack.emplace_back();
+            break;
+        case ineg:
+        case i2f:
+        case i2d:
+        case l2f:
+        case f2i:
+        case f2d:
+        case d2i:
+        case arraylength:
+        case newarray:
+            popTags();
+            if (opcode == newarray)
+            {
+                readU1();
+            }
+            stack.emplace_back();
+            break;
+        case iinc:
+            readU2();
+            break;
+        case ifeq:
+        case ifne:
+        case iflt:
+        case ifge:
+        case ifgt:
+        case ifle:
+        case if_icmpeq:
+        case if_icmpne:
+        case if_icmplt:
+        case if_icmpge:
+        case if_icmpgt:
+        case if_icmple:
+        case if_acmpeq:
+        case if_acmpne:
+        case goto_:
+            readU2();
+            if (opcode >= if_icmpeq && opcode != goto_)
+            {
+                popValues(2, false);
+            }
+            else if (opcode != goto_)
+            {
+                popTags();
+            }
+
+            if (!stack.empty())
+            {
+                throw fmt::format("Branch with values on the stack.");
+            }
+            break;
+        case ireturn:
+        case lreturn:
+        case freturn:
+        case dreturn:
+        case areturn:
+        case return_:
+            if (opcode != return_)
+            {
+                write(popTags());
+            }
+            stack.clear();
+            break;
+        case getstatic:
+        {
+            auto & field = std::get<Fieldref>(owner.constantPool[readU2()]);
+            stack.emplace_back();
+            if (descriptor(field.name_and_type_index).starts_with("["))
+            {
+                stack.back().insert(fieldKey(owner, field));
+            }
+            break;
+        }
+        case putstatic:
+        case putfield:
+            readU2();
+            popValues(opcode == putstatic ? 1 : 2, true);
+            break;
+        case getfield:
+        case anewarray:
+            readU2();
+            popTags();
+            stack.emplace_back();
+            break;
+        case new_:
+            readU2();
+            stack.emplace_back();
+            break;
+        case invokevirtual:
+        case invokespecial:
+        case invokestatic:
+        case invokedynamic:
+        {
+            auto index = readU2();
+            u2 nameAndTypeIndex;
+            if (opcode == invokedynamic)
+            {
+                readU2();
+                nameAndTypeIndex = std::get<InvokeDynamic>(owner.constantPool[index]).name_and_type_index;
+            }
+            else
+            {
+                nameAndTypeIndex = std::get<Methodref>(owner.constantPool[index]).name_and_type_index;
+            }
+
+            auto desc = descriptor(nameAndTypeIndex);
+            auto argsCount = countArgs(desc) + ((opcode == invokevirtual || opcode == invokespecial) ? 1 : 0);
+            popValues(argsCount, true);
+            if (!desc.ends_with(")V"))
+            {
+                stack.emplace_back();
+            }
+            break;
+        }
+        default:
+            throw fmt::format("Opcode '{:x}' isn't scanned.", opcode);
+        }
+    }
+}
+
+}
+
+std::set<FieldKey> findWrittenArrays(const std::vector<ClassFile> & sources)
+{
+    std::set<FieldKey> written;
+    for (auto & source : sources)
+    {
+        for (auto & meth : source.methodsToDecompile)
+        {
+            auto function = source.findFunction(meth.name, meth.descriptor);
+            if (function && !function->reachable)
+            {
+                continue;
+            }
+
+            try
+            {
+                Reader buffer(meth.buffer);
+                if (!buffer.size())
+                {
+                    continue;
+                }
+
+                [[maybe_unused]] u2 max_stack = r16();
+                [[maybe_unused]] u2 max_locals = r16();
+                u4 code_length = r32();
+
+                ArrayWriteScan scan(source, buffer.view(code_length), meth.name == STATIC_INIT, written);
+                scan.run();
+            }
+            catch (const std::string &)
+            {
+                // every array field the class refers to may be written
+                for (size_t i = 0; i < source.constantPool.size(); ++i)
+                {
+                    auto field = std::get_if<Fieldref>(&source.constantPool[i]);
+                    if (!field)
+                    {
+                        continue;
+                    }
+
+                    auto & nat = std::get<NameAndType>(source.constantPool[field->name_and_type_index]);
+                    if (source.getStringFromUtf8(nat.descriptor_index).starts_with("["))
+                    {
+                        written.insert(fieldKey(source, *field));
+                    }
+                }
+            }
+        }
+    }
+    return written;
+}
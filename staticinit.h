@@ -0,0 +1,27 @@
+#ifndef STATICINIT_H
+#define STATICINIT_H
+
+#include "classfile.h"
+
+struct StaticInit
+{
+    std::string_view field;
+    std::string init; // C++ initialiser
+    bool constant; // only numbers, can be constexpr
+};
+
+// Runs <clinit> at transpile time and returns the final value of the static
+// fields of the class it could compute, loops and array stores included.
+// Calls are skipped like when <clinit> is decompiled, what they return and the
+// arrays given to them are unknown. Nothing is returned when the code branches
+// on an unknown value or uses an unhandled opcode.
+std::vector<StaticInit> evaluateStaticInit(const ClassFile & owner, std::span<const u1> code);
+
+using FieldKey = std::pair<std::string_view, std::string_view>; // class path, field name, interned
+
+// Static array fields whose elements the sources may write outside the
+// <clinit> of their class: stored into, or given to code the scan doesn't
+// follow (calls, other fields, returned). Any other array field is read-only.
+std::set<FieldKey> findWrittenArrays(const std::vector<ClassFile> & sources);
+
+#endif // STATICINIT_H